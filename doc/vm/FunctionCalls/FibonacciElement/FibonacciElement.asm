@@ -0,0 +1,236 @@
+@__vm_start
+0;JMP
+(__vm_call)
+@SP
+A=M
+M=D
+@LCL
+D=M
+@SP
+AM=M+1
+M=D
+@ARG
+D=M
+@SP
+AM=M+1
+M=D
+@THIS
+D=M
+@SP
+AM=M+1
+M=D
+@THAT
+D=M
+@SP
+AM=M+1
+M=D
+@SP
+MD=M+1
+@LCL
+M=D
+@R13
+D=D-M
+@5
+D=D-A
+@ARG
+M=D
+@R14
+A=M
+0;JMP
+(__vm_return)
+@LCL
+D=M
+@R13
+M=D
+@5
+A=D-A
+D=M
+@R14
+M=D
+@SP
+AM=M-1
+D=M
+@ARG
+A=M
+M=D
+@ARG
+D=M+1
+@SP
+M=D
+@R13
+AM=M-1
+D=M
+@THAT
+M=D
+@R13
+AM=M-1
+D=M
+@THIS
+M=D
+@R13
+AM=M-1
+D=M
+@ARG
+M=D
+@R13
+AM=M-1
+D=M
+@LCL
+M=D
+@R14
+A=M
+0;JMP
+(__vm_start)
+@256
+D=A
+@SP
+M=D
+@R13
+M=0
+@Sys.init
+D=A
+@R14
+M=D
+@__vm_bootstrap
+D=A
+@__vm_call
+0;JMP
+(__vm_bootstrap)
+(Main.fibonacci)
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@2
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+A=A-1
+D=M-D
+M=-1
+@Main_ltlabel_1
+D;JLT
+@SP
+A=M-1
+M=0
+(Main_ltlabel_1)
+@SP
+AM=M-1
+D=M
+@Main.fibonacci$IF_TRUE
+D;JNE
+@Main.fibonacci$IF_FALSE
+0;JMP
+(Main.fibonacci$IF_TRUE)
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@__vm_return
+0;JMP
+(Main.fibonacci$IF_FALSE)
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@2
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+AM=M-1
+D=M
+A=A-1
+M=M-D
+@R13
+M=1
+@Main.fibonacci
+D=A
+@R14
+M=D
+@Main.fibonacci$ret.2
+D=A
+@__vm_call
+0;JMP
+(Main.fibonacci$ret.2)
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+A=M-1
+M=M-1
+@R13
+M=1
+@Main.fibonacci
+D=A
+@R14
+M=D
+@Main.fibonacci$ret.3
+D=A
+@__vm_call
+0;JMP
+(Main.fibonacci$ret.3)
+@SP
+AM=M-1
+D=M
+A=A-1
+M=D+M
+@__vm_return
+0;JMP
+(Sys.init)
+@4
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@R13
+M=1
+@Main.fibonacci
+D=A
+@R14
+M=D
+@Sys.init$ret.1
+D=A
+@__vm_call
+0;JMP
+(Sys.init$ret.1)
+(Sys.init$WHILE)
+@Sys.init$WHILE
+0;JMP
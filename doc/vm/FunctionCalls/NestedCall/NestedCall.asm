@@ -0,0 +1,408 @@
+@__vm_start
+0;JMP
+(__vm_call)
+@SP
+A=M
+M=D
+@LCL
+D=M
+@SP
+AM=M+1
+M=D
+@ARG
+D=M
+@SP
+AM=M+1
+M=D
+@THIS
+D=M
+@SP
+AM=M+1
+M=D
+@THAT
+D=M
+@SP
+AM=M+1
+M=D
+@SP
+MD=M+1
+@LCL
+M=D
+@R13
+D=D-M
+@5
+D=D-A
+@ARG
+M=D
+@R14
+A=M
+0;JMP
+(__vm_return)
+@LCL
+D=M
+@R13
+M=D
+@5
+A=D-A
+D=M
+@R14
+M=D
+@SP
+AM=M-1
+D=M
+@ARG
+A=M
+M=D
+@ARG
+D=M+1
+@SP
+M=D
+@R13
+AM=M-1
+D=M
+@THAT
+M=D
+@R13
+AM=M-1
+D=M
+@THIS
+M=D
+@R13
+AM=M-1
+D=M
+@ARG
+M=D
+@R13
+AM=M-1
+D=M
+@LCL
+M=D
+@R14
+A=M
+0;JMP
+(__vm_start)
+@256
+D=A
+@SP
+M=D
+@R13
+M=0
+@Sys.init
+D=A
+@R14
+M=D
+@__vm_bootstrap
+D=A
+@__vm_call
+0;JMP
+(__vm_bootstrap)
+(Sys.init)
+@4000
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@3
+M=D
+@5000
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@4
+M=D
+@R13
+M=0
+@Sys.main
+D=A
+@R14
+M=D
+@Sys.init$ret.1
+D=A
+@__vm_call
+0;JMP
+(Sys.init$ret.1)
+@5
+D=A
+@1
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+(Sys.init$LOOP)
+@Sys.init$LOOP
+0;JMP
+(Sys.main)
+@SP
+A=M
+M=0
+A=A+1
+M=0
+A=A+1
+M=0
+A=A+1
+M=0
+A=A+1
+M=0
+A=A+1
+D=A
+@SP
+M=D
+@4001
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@3
+M=D
+@5001
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@4
+M=D
+@200
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@LCL
+D=M
+@1
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@40
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@LCL
+D=M
+@2
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@6
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@LCL
+D=M
+@3
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@123
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@R13
+M=1
+@Sys.add12
+D=A
+@R14
+M=D
+@Sys.main$ret.2
+D=A
+@__vm_call
+0;JMP
+(Sys.main$ret.2)
+@5
+D=A
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@LCL
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@LCL
+D=M
+@1
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@LCL
+D=M
+@2
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@LCL
+D=M
+@3
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@LCL
+D=M
+@4
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+AM=M-1
+D=M
+A=A-1
+M=D+M
+@SP
+AM=M-1
+D=M
+A=A-1
+M=D+M
+@SP
+AM=M-1
+D=M
+A=A-1
+M=D+M
+@SP
+AM=M-1
+D=M
+A=A-1
+M=D+M
+@__vm_return
+0;JMP
+(Sys.add12)
+@4002
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@3
+M=D
+@5002
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@4
+M=D
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@12
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+AM=M-1
+D=M
+A=A-1
+M=D+M
+@__vm_return
+0;JMP
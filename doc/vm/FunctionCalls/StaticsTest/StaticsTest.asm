@@ -0,0 +1,322 @@
+@__vm_start
+0;JMP
+(__vm_call)
+@SP
+A=M
+M=D
+@LCL
+D=M
+@SP
+AM=M+1
+M=D
+@ARG
+D=M
+@SP
+AM=M+1
+M=D
+@THIS
+D=M
+@SP
+AM=M+1
+M=D
+@THAT
+D=M
+@SP
+AM=M+1
+M=D
+@SP
+MD=M+1
+@LCL
+M=D
+@R13
+D=D-M
+@5
+D=D-A
+@ARG
+M=D
+@R14
+A=M
+0;JMP
+(__vm_return)
+@LCL
+D=M
+@R13
+M=D
+@5
+A=D-A
+D=M
+@R14
+M=D
+@SP
+AM=M-1
+D=M
+@ARG
+A=M
+M=D
+@ARG
+D=M+1
+@SP
+M=D
+@R13
+AM=M-1
+D=M
+@THAT
+M=D
+@R13
+AM=M-1
+D=M
+@THIS
+M=D
+@R13
+AM=M-1
+D=M
+@ARG
+M=D
+@R13
+AM=M-1
+D=M
+@LCL
+M=D
+@R14
+A=M
+0;JMP
+(__vm_start)
+@256
+D=A
+@SP
+M=D
+@R13
+M=0
+@Sys.init
+D=A
+@R14
+M=D
+@__vm_bootstrap
+D=A
+@__vm_call
+0;JMP
+(__vm_bootstrap)
+(Class1.set)
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@Class1.0
+M=D
+@ARG
+D=M
+@1
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@Class1.1
+M=D
+@SP
+A=M
+AM=0
+M=M+1
+@__vm_return
+0;JMP
+(Class1.get)
+@Class1.0
+D=M
+@SP
+M=M+1
+A=M-1
+M=D
+@Class1.1
+D=M
+@SP
+M=M+1
+A=M-1
+M=D
+@SP
+AM=M-1
+D=M
+A=A-1
+M=M-D
+@__vm_return
+0;JMP
+(Class2.set)
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@Class2.0
+M=D
+@ARG
+D=M
+@1
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@Class2.1
+M=D
+@SP
+A=M
+AM=0
+M=M+1
+@__vm_return
+0;JMP
+(Class2.get)
+@Class2.0
+D=M
+@SP
+M=M+1
+A=M-1
+M=D
+@Class2.1
+D=M
+@SP
+M=M+1
+A=M-1
+M=D
+@SP
+AM=M-1
+D=M
+A=A-1
+M=M-D
+@__vm_return
+0;JMP
+(Sys.init)
+@6
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@8
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@2
+D=A
+@R13
+M=D
+@Class1.set
+D=A
+@R14
+M=D
+@Sys.init$ret.1
+D=A
+@__vm_call
+0;JMP
+(Sys.init$ret.1)
+@5
+D=A
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@23
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@15
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@2
+D=A
+@R13
+M=D
+@Class2.set
+D=A
+@R14
+M=D
+@Sys.init$ret.2
+D=A
+@__vm_call
+0;JMP
+(Sys.init$ret.2)
+@5
+D=A
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@R13
+M=0
+@Class1.get
+D=A
+@R14
+M=D
+@Sys.init$ret.3
+D=A
+@__vm_call
+0;JMP
+(Sys.init$ret.3)
+@R13
+M=0
+@Class2.get
+D=A
+@R14
+M=D
+@Sys.init$ret.4
+D=A
+@__vm_call
+0;JMP
+(Sys.init$ret.4)
+(Sys.init$WHILE)
+@Sys.init$WHILE
+0;JMP
@@ -0,0 +1,107 @@
+@SP
+A=M
+AM=0
+M=M+1
+@LCL
+D=M
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+(BasicLoop$LOOP_START)
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@LCL
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+AM=M-1
+D=M
+A=A-1
+M=D+M
+@LCL
+D=M
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+A=M-1
+M=M-1
+@ARG
+D=M
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+AM=M-1
+D=M
+@BasicLoop$LOOP_START
+D;JNE
+@LCL
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
@@ -0,0 +1,186 @@
+@ARG
+D=M
+@1
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@4
+M=D
+@SP
+A=M
+AM=0
+M=M+1
+@THAT
+D=M
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@SP
+M=M+1
+A=M-1
+M=1
+@THAT
+D=M
+@1
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@2
+D=A
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+AM=M-1
+D=M
+A=A-1
+M=M-D
+@ARG
+D=M
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+(FibonacciSeries$MAIN_LOOP_START)
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+AM=M-1
+D=M
+@FibonacciSeries$COMPUTE_ELEMENT
+D;JNE
+@FibonacciSeries$END_PROGRAM
+0;JMP
+(FibonacciSeries$COMPUTE_ELEMENT)
+@THAT
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@THAT
+D=M
+@1
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+AM=M-1
+D=M
+A=A-1
+M=D+M
+@THAT
+D=M
+@2
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@4
+D=M
+@SP
+M=M+1
+A=M-1
+M=D
+@SP
+A=M-1
+M=M+1
+@SP
+M=M-1
+A=M
+D=M
+@4
+M=D
+@ARG
+D=M
+@0
+A=D+A
+D=M
+@SP
+A=M
+M=D
+@SP
+M=M+1
+@SP
+A=M-1
+M=M-1
+@ARG
+D=M
+@0
+D=D+A
+@R15
+M=D
+@SP
+M=M-1
+A=M
+D=M
+@R15
+A=M
+M=D
+@FibonacciSeries$MAIN_LOOP_START
+0;JMP
+(FibonacciSeries$END_PROGRAM)
@@ -6,6 +6,7 @@
 
 #include "parse.hpp"
 #include "overloaded.hpp"
+#include "sourcemap.hpp"
 
 namespace assemble {
   using SymbolMap = std::map<std::string, int>;
@@ -30,7 +31,7 @@ namespace assemble {
     {"D", 0b0001100},
     {"A", 0b0110000},
     {"!D", 0b0001101},
-    {"!A", 0b0110011},
+    {"!A", 0b0110001},
     {"-D", 0b0001111},
     {"-A", 0b0110011},
     {"D+1", 0b0011111},
@@ -102,7 +103,7 @@ namespace assemble {
 
     for (auto inst: instructions) {
       if (auto i = std::get_if<parse::AInstruction>(&inst)) {
-        int address = isalpha(i->value[0]) ? resolve_symbol(user_symbols, i->value) : stoi(i->value);
+        int address = !isdigit(i->value[0]) ? resolve_symbol(user_symbols, i->value) : stoi(i->value);
 
         std::bitset<16> a_inst = address;
         a_inst.set(15, false);
@@ -134,8 +135,27 @@ namespace assemble {
     return results;
   }
 
-  void assemble(std::string input, std::string output) {
-    auto parsed_instructions = parse::parseFile(std::move(input));
+  // Each word maps to its .asm line, inside the last label before it.
+  void writeSourceMap(const std::string &input, const std::vector<parse::Instruction> &instructions,
+                      const std::vector<unsigned int> &lines, const std::string &output) {
+    sourceMap::Builder map;
+    std::string function;
+    for (size_t i = 0; i < instructions.size(); i++) {
+      if (auto label = std::get_if<parse::Label>(&instructions[i])) {
+        function = label->name;
+      } else {
+        map.append(1, {input, lines[i], function});
+      }
+    }
+    map.write(sourceMap::mapPath(output));
+  }
+
+  void assemble(std::string input, std::string output, bool sourceMap) {
+    std::vector<unsigned int> lines;
+    auto parsed_instructions = parse::parseFile(input, sourceMap ? &lines : nullptr);
+    if (sourceMap) {
+      writeSourceMap(input, parsed_instructions, lines, output);
+    }
 
     SymbolMap user_symbols = buildUserSymbols(parsed_instructions);
 
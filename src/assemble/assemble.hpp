@@ -1,3 +1,4 @@
 namespace assemble {
-  void assemble(std::string, std::string);
+  // With sourceMap, also write a .map from ROM addresses to .asm lines.
+  void assemble(std::string, std::string, bool sourceMap = false);
 }
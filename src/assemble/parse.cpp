@@ -99,7 +99,7 @@ namespace parse {
     return std::nullopt;
   }
 
-  std::vector<Instruction> parseFile(std::string input_filepath) {
+  std::vector<Instruction> parseFile(std::string input_filepath, std::vector<unsigned int> *lines) {
     std::vector<Instruction> parsed;
 
     std::ifstream input_file {input_filepath};
@@ -108,10 +108,13 @@ namespace parse {
     }
 
     std::string line;
+    unsigned int number = 0;
     while (std::getline(input_file, line)) {
+      number++;
       auto parsed_line = parseLine(line);
       if (parsed_line.has_value()) {
         parsed.push_back(parsed_line.value());
+        if (lines) { lines->push_back(number); }
       }
     }    
 
@@ -22,5 +22,6 @@ namespace parse {
 
     using Instruction = std::variant<AInstruction, CInstruction, Label>;
 
-    std::vector<Instruction> parseFile(std::string input_filepath);
+    // lines, if given, gets the source line of each instruction.
+    std::vector<Instruction> parseFile(std::string input_filepath, std::vector<unsigned int> *lines = nullptr);
 }
\ No newline at end of file
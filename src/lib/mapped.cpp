@@ -0,0 +1,37 @@
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped.hpp"
+
+MappedFile::MappedFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::invalid_argument("Could not find file" + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::invalid_argument("Could not find file" + path);
+    }
+    length = info.st_size;
+    if (length == 0) {
+        // mmap refuses empty files; there is nothing to map anyway.
+        close(fd);
+        return;
+    }
+    mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        mapped = nullptr;
+        throw std::invalid_argument("Could not map file" + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (mapped) { munmap(mapped, length); }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A whole file mapped read-only into memory, unmapped on destruction.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return static_cast<const char *>(mapped); }
+    size_t size() const { return length; }
+
+  private:
+    void *mapped = nullptr;
+    size_t length = 0;
+};
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include "sourcemap.hpp"
+
+/*
+Source maps
+
+A .map file says which source line each ROM word was generated from, as
+ranges of consecutive words sharing a line. The ranges are sorted by start
+address, so a lookup is a binary search straight over the mapped file.
+*/
+
+namespace sourceMap {
+    const uint32_t magic = 0x314d4d56;  // "VMM1"
+
+    uint32_t Builder::intern(const std::string &s) {
+        auto [hit, added] = stringIndex.emplace(s, strings.size());
+        if (added) { strings.push_back(s); }
+        return hit->second;
+    }
+
+    void Builder::append(uint32_t count, const Location &location) {
+        if (count == 0) { return; }
+
+        Range range {words, intern(location.file), location.line, intern(location.function)};
+        words += count;
+        if (!ranges.empty()) {
+            const auto &last = ranges.back();
+            if (last.file == range.file && last.line == range.line && last.function == range.function) { return; }
+        }
+        ranges.push_back(range);
+    }
+
+    void Builder::append(const std::vector<std::string> &lines, const std::vector<Mark> &marks, const std::string &file) {
+        auto wordsIn = [&](size_t from, size_t to) {
+            return static_cast<uint32_t>(std::count_if(lines.begin() + from, lines.begin() + to,
+                                                       [](const std::string &line) { return line[0] != '('; }));
+        };
+
+        // Words with nothing to go on still take up ROM.
+        auto extend = [&](uint32_t count) {
+            if (!ranges.empty()) {
+                words += count;
+            } else {
+                append(count, {file, 0, ""});
+            }
+        };
+
+        // The last mark with a line, which may have had no words itself.
+        std::optional<Location> current;
+        extend(wordsIn(0, marks.empty() ? lines.size() : marks.front().index));
+        for (size_t i = 0; i < marks.size(); i++) {
+            auto to = i + 1 < marks.size() ? marks[i + 1].index : lines.size();
+            if (marks[i].line != 0 || file.empty()) {
+                current = Location {file, marks[i].line, marks[i].function};
+            }
+            if (current) {
+                append(wordsIn(marks[i].index, to), current.value());
+            } else {
+                extend(wordsIn(marks[i].index, to));
+            }
+        }
+    }
+
+    void Builder::write(const std::string &path) const {
+        std::vector<uint32_t> offsets {0};
+        std::string bytes;
+        for (const auto &s : strings) {
+            bytes += s;
+            offsets.push_back(bytes.size());
+        }
+        // Keep the file a whole number of words.
+        bytes.resize((bytes.size() + 3) / 4 * 4, '\0');
+
+        Header header {magic, static_cast<uint32_t>(ranges.size()), words, static_cast<uint32_t>(strings.size()),
+                       static_cast<uint32_t>(bytes.size())};
+        std::ofstream output_file(path, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+        if (!output_file.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+        output_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        output_file.write(reinterpret_cast<const char *>(ranges.data()), ranges.size() * sizeof(Range));
+        output_file.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint32_t));
+        output_file.write(bytes.data(), bytes.size());
+    }
+
+    View::View(const std::string &path) : path(path), file(path) {
+        if (file.size() < sizeof(Header)) {
+            throw std::invalid_argument("Not a .map file: " + path);
+        }
+
+        auto base = file.data();
+        header = reinterpret_cast<const Header *>(base);
+        size_t expected = sizeof(Header) + size_t(header->ranges) * sizeof(Range)
+            + (size_t(header->strings) + 1) * sizeof(uint32_t) + header->stringBytes;
+        if (header->magic != magic || expected != file.size()) {
+            throw std::invalid_argument("Not a .map file: " + path);
+        }
+        ranges = reinterpret_cast<const Range *>(base + sizeof(Header));
+        offsets = reinterpret_cast<const uint32_t *>(ranges + header->ranges);
+        bytes = reinterpret_cast<const char *>(offsets + header->strings + 1);
+    }
+
+    size_t View::size() const {
+        return header->ranges;
+    }
+
+    uint32_t View::words() const {
+        return header->words;
+    }
+
+    uint32_t View::start(size_t i) const {
+        return ranges[i].start;
+    }
+
+    std::string View::string(uint32_t index) const {
+        if (index >= header->strings || offsets[index] > offsets[index + 1] || offsets[index + 1] > header->stringBytes) {
+            throw std::invalid_argument("Corrupt .map file: " + path);
+        }
+        return std::string(bytes + offsets[index], offsets[index + 1] - offsets[index]);
+    }
+
+    Location View::operator[](size_t i) const {
+        return {string(ranges[i].file), ranges[i].line, string(ranges[i].function)};
+    }
+
+    std::optional<Location> View::find(uint32_t address) const {
+        if (address >= words()) { return std::nullopt; }
+        auto end = ranges + size();
+        auto hit = std::upper_bound(ranges, end, address, [](uint32_t a, const Range &r) { return a < r.start; });
+        if (hit == ranges) { return std::nullopt; }
+        return (*this)[hit - ranges - 1];
+    }
+
+    void print(const View &view, std::ostream &out) {
+        for (size_t i = 0; i < view.size(); i++) {
+            auto end = i + 1 < view.size() ? view.start(i + 1) : view.words();
+            auto location = view[i];
+            auto source = location.file.empty() ? std::string("-") : location.file + ":" + std::to_string(location.line);
+            out << boost::format("%5d-%-5d %-30s %s") % view.start(i) % (end - 1) % source % location.function << std::endl;
+        }
+    }
+
+    std::string mapPath(const std::string &output) {
+        return std::filesystem::path(output).replace_extension(".map").string();
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "mapped.hpp"
+
+namespace sourceMap {
+    /*
+    .map layout, in the host's byte order and 4-byte aligned:
+
+        Header
+        Range[ranges]                   in ROM order
+        uint32_t offsets[strings + 1]   into the string bytes
+        char bytes[stringBytes]         file and function names
+    */
+    struct Header {
+        uint32_t magic;
+        uint32_t ranges;
+        uint32_t words;
+        uint32_t strings;
+        uint32_t stringBytes;
+    };
+
+    // ROM words from start up to the next range (or words, for the last)
+    // came from line of file, inside function. file and function are string
+    // indices; line 0 and an empty file mark generated code.
+    struct Range {
+        uint32_t start;
+        uint32_t file;
+        uint32_t line;
+        uint32_t function;
+    };
+
+    struct Location {
+        std::string file;
+        unsigned int line;
+        std::string function;
+    };
+
+    // Where the code for one command starts in a list of assembly lines.
+    // Line 0 is a command with no line of its own in a file's code, and
+    // the usual line for generated code, which has no file.
+    struct Mark {
+        size_t index;
+        unsigned int line;
+        std::string function;
+    };
+
+    // Collects ranges in ROM order, starting at address 0.
+    class Builder {
+      public:
+        // The next words words came from location.
+        void append(uint32_t words, const Location &location);
+        // Assembly lines about to follow in ROM, each mark covering its lines
+        // up to the next. Lines ahead of the first mark, and those of marks
+        // with line 0 when there is a file, go with whatever came before.
+        void append(const std::vector<std::string> &lines, const std::vector<Mark> &marks, const std::string &file);
+
+        void write(const std::string &path) const;
+
+      private:
+        uint32_t intern(const std::string &s);
+
+        std::vector<Range> ranges;
+        uint32_t words = 0;
+        std::vector<std::string> strings;
+        std::map<std::string, uint32_t> stringIndex;
+    };
+
+    // A .map file mapped into memory, for looking up addresses.
+    class View {
+      public:
+        explicit View(const std::string &path);
+
+        size_t size() const;
+        uint32_t words() const;
+        uint32_t start(size_t i) const;
+        Location operator[](size_t i) const;
+        // Where the word at address came from, if it is in the program.
+        std::optional<Location> find(uint32_t address) const;
+
+      private:
+        std::string string(uint32_t index) const;
+
+        std::string path;
+        MappedFile file;
+        const Header *header = nullptr;
+        const Range *ranges = nullptr;
+        const uint32_t *offsets = nullptr;
+        const char *bytes = nullptr;
+    };
+
+    // One range per line: addresses, file:line and function.
+    void print(const View &view, std::ostream &out);
+
+    // The .map to go with an .asm or .hack output.
+    std::string mapPath(const std::string &output);
+}
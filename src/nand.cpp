@@ -3,6 +3,7 @@
 #include <CLI11.hpp>
 
 #include "assemble/assemble.hpp"
+#include "sourcemap.hpp"
 #include "vm/vm.hpp"
 
 int main(int argc, char** argv) {
@@ -18,21 +19,74 @@ int main(int argc, char** argv) {
   }
 
   std::string input_filepath, output_filepath;
+  vm::Options vm_options;
 
   CLI::App* assemble_command = app.add_subcommand("assemble", "Assemble .asm assembly to .hack binaries");
   assemble_command->add_option("input", input_filepath, ".asm file to assemble")->required();
   assemble_command->add_option("output", output_filepath, ".hack file to output")->required();
 
-  assemble_command->callback(([&input_filepath, &output_filepath]{
-    assemble::assemble(std::move(input_filepath), std::move(output_filepath));
+  bool assemble_source_map = false;
+  assemble_command->add_flag("--source-map", assemble_source_map, "Write a .map from ROM addresses to .asm lines next to the output");
+
+  assemble_command->callback(([&input_filepath, &output_filepath, &assemble_source_map]{
+    assemble::assemble(std::move(input_filepath), std::move(output_filepath), assemble_source_map);
   }));
 
   CLI::App* vm_command = app.add_subcommand("vm", "Assemble VM code to .asm assembly");
-  vm_command->add_option("input", input_filepath, ".vm file to translate")->required();
-  vm_command->add_option("output", output_filepath, ".asm file to output")->required();
+  vm_command->add_option("input", input_filepath, ".vm or .vmb file, or directory of them, to translate")->required();
+  vm_command->add_option("output", output_filepath, ".asm or .hack file to output, or .vmb to save parsed bytecode")->required();
+  vm_command->add_flag("--cache-top", vm_options.cacheTop, "Keep the top of the stack in D between commands");
+  vm_command->add_flag("--virtual-sp", vm_options.virtualSp, "Track SP at compile time within straight-line code");
+  unsigned int optimization_level = 0;
+  vm_command->add_option("-O", optimization_level, "Optimization level: 1 turns on the bytecode passes and stack caching, 2 adds SSA value numbering");
+  vm_command->add_flag("--ssa", vm_options.ssa, "Reuse computed values and drop copies and dead stores within blocks");
+  vm_command->add_flag("--fold-constants", vm_options.foldConstants, "Evaluate arithmetic on known constants at translation time");
+  vm_command->add_flag("--fuse-arrays", vm_options.fuseArrays, "Load and store array elements directly instead of through THAT");
+  vm_command->add_flag("--fuse-moves", vm_options.fuseMoves, "Turn push/pop pairs into direct segment moves");
+  vm_command->add_flag("--fuse-branches", vm_options.fuseBranches, "Jump directly on eq/gt/lt results consumed by if-goto");
+  vm_command->add_flag("--shared-compare", vm_options.sharedCompare, "Call one shared routine per eq/gt/lt instead of inlining them");
+  vm_command->add_flag("--tail-calls", vm_options.tailCalls, "Reuse the caller's frame for a call followed by return");
+  vm_command->add_flag("--drop-dead-functions", vm_options.dropDeadFunctions, "Drop functions that no call chain from Sys.init reaches");
+  vm_command->add_flag("--static-frames", vm_options.staticFrames, "Give non-recursive functions fixed frames (directories with Sys.init)");
+  vm_command->add_flag("--pack-statics", vm_options.packStatics, "Give statics numeric addresses across all files, dropping unread ones");
+  vm_command->add_option("--inline", vm_options.inlineThreshold, "Inline leaf functions of at most this many commands");
+  vm_command->add_option("--inline-budget", vm_options.inlineBudget, "Most commands inlining may add to the program", true);
+  vm_command->add_option("--rom-budget", vm_options.romBudget, "Most words of ROM to take, inlining the hottest comparisons, calls and returns that fit");
+  vm_command->add_option("--profile", vm_options.profile, "Counts from an earlier run: inline what ran most, share and move aside what never ran");
+  vm_command->add_flag("--stream", vm_options.stream, "Translate one function at a time, in memory independent of input size");
+  vm_command->add_option("--jobs", vm_options.jobs, "Workers for parsing, passes and translation; 0 uses one per hardware thread", true);
+  std::vector<std::string> enabled_passes;
+  std::vector<std::string> disabled_passes;
+  vm_command->add_option("--enable-pass", enabled_passes, "Turn on a per-function pass by name, as its flag does");
+  vm_command->add_option("--disable-pass", disabled_passes, "Turn off a per-function pass by name, even under -O");
+  vm_command->add_flag("--instrument", vm_options.instrument, "Count function entries and loop back-edges in RAM from 255 down, above the statics");
+  vm_command->add_flag("--source-map", vm_options.sourceMap, "Write a .map from ROM addresses to .vm lines next to the output");
+  vm_command->add_flag("--cost-report", vm_options.costReport, "Print the words each file, function and kind of command costs");
+  vm_command->add_option("--cost-json", vm_options.costJson, "Write the cost report as JSON to this file");
+  vm_command->add_flag("--report", vm_options.report, "Print what each optimization pass did");
   
-  vm_command->callback(([&input_filepath, &output_filepath]{
-    vm::vm(std::move(input_filepath), std::move(output_filepath));
+  vm_command->callback(([&input_filepath, &output_filepath, &vm_options, &optimization_level, &enabled_passes, &disabled_passes]{
+    vm::setOptimizationLevel(vm_options, optimization_level);
+    for (const auto &pass : enabled_passes) { vm::enablePass(vm_options, pass, true); }
+    for (const auto &pass : disabled_passes) { vm::enablePass(vm_options, pass, false); }
+    vm::vm(std::move(input_filepath), std::move(output_filepath), vm_options);
+  }));
+
+  CLI::App* map_command = app.add_subcommand("map", "Print the ROM ranges in a .map source map");
+  map_command->add_option("input", input_filepath, ".map file to print")->required();
+
+  map_command->callback(([&input_filepath]{
+    sourceMap::print(sourceMap::View(input_filepath), std::cout);
+  }));
+
+  std::string runs_filepath;
+  CLI::App* profile_command = app.add_subcommand("profile", "Turn runs per ROM address into line counts for vm --profile");
+  profile_command->add_option("map", input_filepath, ".map written with the build that ran")->required();
+  profile_command->add_option("runs", runs_filepath, "Runs of each ROM address, \"address count\" per line")->required();
+  profile_command->add_option("output", output_filepath, "Profile to write")->required();
+
+  profile_command->callback(([&input_filepath, &runs_filepath, &output_filepath]{
+    vm::lineProfile(input_filepath, runs_filepath, output_filepath);
   }));
 
   CLI11_PARSE(app, argc, new_argv.data());
@@ -0,0 +1,193 @@
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "binary.hpp"
+#include "overloaded.hpp"
+
+/*
+Binary bytecode
+
+A .vmb file holds the parsed bytecode of one .vm file, so loading it is a
+matter of mapping it and reading fixed-width records. It is written in the
+host's byte order; the magic number reads back wrong on a host of the other
+order and the file is rejected.
+*/
+
+namespace vmBinary {
+    const uint32_t magic = 0x32424d56;  // "VMB2"
+
+    // Record kinds are variant indices, decoded by the switch in View.
+    static_assert(std::variant_size_v<vmParse::Bytecode> == 8, "Update the .vmb record kinds");
+
+    // Records hold enums in a byte; these bound what a valid file can hold.
+    const uint8_t logicCommands = vmParse::LogicCommand::NOT + 1;
+    const uint8_t memoryCommands = vmParse::MemoryCommand::POP + 1;
+    const uint8_t memorySegments = vmParse::MemorySegment::ABSOLUTE + 1;
+    const uint8_t flowCommands = vmParse::FlowCommand::IF_GOTO + 1;
+    const uint8_t functionCommands = vmParse::FunctionCommand::TAIL_CALL + 1;
+
+    void write(const std::vector<vmParse::Bytecode> &bytecode, const std::string &path) {
+        std::vector<Record> records;
+        std::vector<std::string> strings;
+        std::map<std::string, uint32_t> stringIndex;
+        auto intern = [&](const std::string &s) {
+            auto [hit, added] = stringIndex.emplace(s, strings.size());
+            if (added) { strings.push_back(s); }
+            return hit->second;
+        };
+
+        for (const auto &b : bytecode) {
+            Record record {static_cast<uint8_t>(b.index()), 0, 0, 0, 0, 0, vmParse::lineOf(b)};
+            std::visit(overloaded {
+                [&](const vmParse::LogicBytecode &l) { record.command = l.command; },
+                [&](const vmParse::MemoryBytecode &m) {
+                    record.command = m.command;
+                    record.segment = m.segment;
+                    record.value = m.value;
+                },
+                [&](const vmParse::MoveBytecode &m) {
+                    record.segment = m.fromSegment;
+                    record.value = m.fromValue;
+                    record.toSegment = m.toSegment;
+                    record.extra = m.toValue;
+                },
+                [&](const vmParse::FlowBytecode &f) {
+                    record.command = f.command;
+                    record.value = intern(f.label);
+                },
+                [&](const vmParse::FunctionBytecode &f) {
+                    record.command = f.command;
+                    record.value = intern(f.name);
+                    record.extra = f.value;
+                },
+                [&](const vmParse::CompareBranchBytecode &c) {
+                    record.command = c.command;
+                    record.toSegment = c.negated;
+                    record.value = intern(c.label);
+                },
+                [&](const vmParse::CountBytecode &c) { record.value = c.address; },
+                [&](const vmParse::ArrayBytecode &a) {
+                    // The two flags ride above the command bit.
+                    record.command = a.command | a.setsThat << 1 | a.setsTemp << 2;
+                    record.segment = a.baseSegment;
+                    record.value = a.baseValue;
+                    record.toSegment = a.indexSegment;
+                    record.extra = a.indexValue;
+                },
+            }, b);
+            records.push_back(record);
+        }
+
+        std::vector<uint32_t> offsets {0};
+        std::string bytes;
+        for (const auto &s : strings) {
+            bytes += s;
+            offsets.push_back(bytes.size());
+        }
+        // Keep the file a whole number of words.
+        bytes.resize((bytes.size() + 3) / 4 * 4, '\0');
+
+        Header header {magic, static_cast<uint32_t>(records.size()), static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(bytes.size())};
+        std::ofstream output_file(path, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+        if (!output_file.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+        output_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        output_file.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(Record));
+        output_file.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint32_t));
+        output_file.write(bytes.data(), bytes.size());
+    }
+
+    View::View(const std::string &path) : path(path), file(path) {
+        if (file.size() < sizeof(Header)) {
+            throw std::invalid_argument("Not a .vmb file: " + path);
+        }
+
+        // Check the sizes once here so that access needs no more than an
+        // index check.
+        auto base = file.data();
+        header = reinterpret_cast<const Header *>(base);
+        size_t expected = sizeof(Header) + size_t(header->records) * sizeof(Record)
+            + (size_t(header->strings) + 1) * sizeof(uint32_t) + header->stringBytes;
+        if (header->magic != magic || expected != file.size()) {
+            throw std::invalid_argument("Not a .vmb file: " + path);
+        }
+        records = reinterpret_cast<const Record *>(base + sizeof(Header));
+        offsets = reinterpret_cast<const uint32_t *>(records + header->records);
+        bytes = reinterpret_cast<const char *>(offsets + header->strings + 1);
+    }
+
+    size_t View::size() const {
+        return header->records;
+    }
+
+    std::string View::string(uint32_t index) const {
+        if (index >= header->strings || offsets[index] > offsets[index + 1] || offsets[index + 1] > header->stringBytes) {
+            throw std::invalid_argument("Corrupt .vmb file: " + path);
+        }
+        return std::string(bytes + offsets[index], offsets[index + 1] - offsets[index]);
+    }
+
+    vmParse::Bytecode View::operator[](size_t i) const {
+        auto bytecode = decode(records[i]);
+        vmParse::setLine(bytecode, records[i].line);
+        return bytecode;
+    }
+
+    vmParse::Bytecode View::decode(const Record &r) const {
+        auto check = [&](bool valid) {
+            if (!valid) { throw std::invalid_argument("Corrupt .vmb file: " + path); }
+        };
+
+        switch(r.kind) {
+            case 0:
+                check(r.command < logicCommands);
+                return vmParse::LogicBytecode {static_cast<vmParse::LogicCommand>(r.command)};
+            case 1:
+                check(r.command < memoryCommands && r.segment < memorySegments);
+                return vmParse::MemoryBytecode {
+                    static_cast<vmParse::MemoryCommand>(r.command), static_cast<vmParse::MemorySegment>(r.segment), r.value
+                };
+            case 2:
+                check(r.segment < memorySegments && r.toSegment < memorySegments);
+                return vmParse::MoveBytecode {
+                    static_cast<vmParse::MemorySegment>(r.segment), r.value, static_cast<vmParse::MemorySegment>(r.toSegment), r.extra
+                };
+            case 3:
+                check(r.command < flowCommands);
+                return vmParse::FlowBytecode {static_cast<vmParse::FlowCommand>(r.command), string(r.value)};
+            case 4:
+                check(r.command < functionCommands);
+                return vmParse::FunctionBytecode {static_cast<vmParse::FunctionCommand>(r.command), string(r.value), r.extra};
+            case 5:
+                check(r.command < logicCommands);
+                return vmParse::CompareBranchBytecode {static_cast<vmParse::LogicCommand>(r.command), r.toSegment != 0, string(r.value)};
+            case 6:
+                return vmParse::CountBytecode {r.value};
+            case 7:
+                check(r.command < 8 && (r.command & 1) < memoryCommands && r.segment < memorySegments && r.toSegment < memorySegments);
+                return vmParse::ArrayBytecode {
+                    static_cast<vmParse::MemoryCommand>(r.command & 1), static_cast<vmParse::MemorySegment>(r.segment), r.value,
+                    static_cast<vmParse::MemorySegment>(r.toSegment), r.extra, (r.command & 2) != 0, (r.command & 4) != 0
+                };
+            default:
+                check(false);
+                throw std::out_of_range("Unreachable condition");
+        }
+    }
+
+    std::vector<vmParse::Bytecode> load(const std::string &path) {
+        View view(path);
+        std::vector<vmParse::Bytecode> result;
+        result.reserve(view.size());
+        for (size_t i = 0; i < view.size(); i++) {
+            result.push_back(view[i]);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped.hpp"
+#include "parse.hpp"
+
+namespace vmBinary {
+    /*
+    .vmb layout, in the host's byte order and 4-byte aligned:
+
+        Header
+        Record[records]
+        uint32_t offsets[strings + 1]   into the string bytes
+        char bytes[stringBytes]         labels and function names
+    */
+    struct Header {
+        uint32_t magic;
+        uint32_t records;
+        uint32_t strings;
+        uint32_t stringBytes;
+    };
+
+    // One Bytecode. kind is its index in the variant; the other fields
+    // depend on kind, with labels and function names as string indices.
+    // line is the line of the .vm file the command came from.
+    struct Record {
+        uint8_t kind;
+        uint8_t command;
+        uint8_t segment;
+        uint8_t toSegment;
+        uint32_t value;
+        uint32_t extra;
+        uint32_t line;
+    };
+
+    void write(const std::vector<vmParse::Bytecode> &bytecode, const std::string &path);
+
+    // A .vmb file mapped into memory. Records are decoded on access, so
+    // opening one costs the same whatever its size.
+    class View {
+      public:
+        explicit View(const std::string &path);
+
+        size_t size() const;
+        vmParse::Bytecode operator[](size_t i) const;
+
+      private:
+        vmParse::Bytecode decode(const Record &record) const;
+        std::string string(uint32_t index) const;
+
+        std::string path;
+        MappedFile file;
+        const Header *header = nullptr;
+        const Record *records = nullptr;
+        const uint32_t *offsets = nullptr;
+        const char *bytes = nullptr;
+    };
+
+    std::vector<vmParse::Bytecode> load(const std::string &path);
+}
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "budget.hpp"
+#include "parse.hpp"
+#include "program.hpp"
+#include "routines.hpp"
+#include "vm.hpp"
+
+/*
+ROM budget
+
+Comparisons in the plain translator, and calls and returns in both, can run
+inline or jump to a routine shared by every site. Sharing saves words at each
+site and costs cycles every time the site runs: the jump there and back, and
+for calls the arguments passed through R13 and R14. Given the words the
+program leaves spare with every site shared, inlining is a 0/1 knapsack: each
+site weighs the extra words its inline code takes, and is worth the cycles it
+saves times how often it is expected to run.
+
+The routines themselves are counted as staying in, so a routine that ends up
+with no sites makes the program smaller than planned, never bigger.
+*/
+
+namespace vmBudget {
+    // Deeper loops than this all count the same.
+    const unsigned int maxDepth = 4;
+
+    std::vector<Loop> findLoops(const std::vector<vmParse::Bytecode> &bytecode) {
+        std::vector<Loop> loops;
+        std::string function;
+        std::map<std::string, size_t> labels;
+        std::map<std::string, size_t> lastJump;
+        auto closeLoops = [&]() {
+            for (const auto &[label, jump] : lastJump) {
+                loops.push_back({function, label, labels[label], jump});
+            }
+            labels.clear();
+            lastJump.clear();
+        };
+
+        for (size_t i = 0; i < bytecode.size(); i++) {
+            if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode[i]); b && b->command == vmParse::FunctionCommand::FUNCTION) {
+                closeLoops();
+                function = b->name;
+            } else if (auto b = std::get_if<vmParse::FlowBytecode>(&bytecode[i])) {
+                if (b->command == vmParse::FlowCommand::LABEL) {
+                    labels[b->label] = i;
+                } else if (labels.count(b->label)) {
+                    lastJump[b->label] = i;
+                }
+            } else if (auto b = std::get_if<vmParse::CompareBranchBytecode>(&bytecode[i]); b && labels.count(b->label)) {
+                lastJump[b->label] = i;
+            }
+        }
+        closeLoops();
+        return loops;
+    }
+
+    Hotness loopHotness(const vmProgram::Program &program) {
+        Hotness hotness;
+        for (const auto &unit : program) {
+            const auto &bytecode = unit.bytecode;
+            // +1 where each loop starts and -1 just past where it ends.
+            std::vector<int> change(bytecode.size() + 1);
+            for (const auto &loop : findLoops(bytecode)) {
+                change[loop.start]++;
+                change[loop.end + 1]--;
+            }
+
+            std::vector<double> unitHotness;
+            int depth = 0;
+            for (size_t i = 0; i < bytecode.size(); i++) {
+                depth += change[i];
+                unitHotness.push_back(std::pow(10.0, std::min<unsigned int>(depth, maxDepth)));
+            }
+            hotness.push_back(std::move(unitHotness));
+        }
+        return hotness;
+    }
+
+    // Words and cycles of the shared and the inline code for a site.
+    struct Costs {
+        unsigned int siteWords;
+        unsigned int routineWords;
+        unsigned int inlineWords;
+    };
+
+    Site site(size_t unit, size_t index, const std::string &name, const Costs &costs, double hotness, bool inlinedByDefault) {
+        // Every routine runs straight through, each word once.
+        return {unit, index, name, costs.inlineWords - costs.siteWords, costs.siteWords + costs.routineWords - costs.inlineWords, hotness,
+                inlinedByDefault};
+    }
+
+    std::vector<Site> shareAll(vmProgram::Program &program, const vm::Options &options, const Hotness &hotness) {
+        // The plain translator has inline and shared comparisons; the
+        // caching one compares in D, with no routine to share.
+        bool sharedCompares = !options.cacheTop && !options.virtualSp;
+        vmRoutines::Usage scratch;
+        auto words = [](const std::vector<std::string> &lines) { return vmRoutines::countWords(lines); };
+
+        std::vector<Site> sites;
+        for (size_t u = 0; u < program.size(); u++) {
+            auto &bytecode = program[u].bytecode;
+            for (size_t i = 0; i < bytecode.size(); i++) {
+                if (auto b = std::get_if<vmParse::LogicBytecode>(&bytecode[i])) {
+                    if (!sharedCompares || (b->command != vmParse::EQ && b->command != vmParse::GT && b->command != vmParse::LT)) { continue; }
+                    auto name = vmRoutines::compareName(b->command);
+                    Costs costs {
+                        words(vmRoutines::compareSite(b->command, "label", scratch)),
+                        words(vmRoutines::routine(name)),
+                        words(vmRoutines::compareBody(vmRoutines::compareJump(b->command), "label"))
+                    };
+                    b->placement = vmParse::SHARED;
+                    sites.push_back(site(u, i, name, costs, hotness[u][i], !options.sharedCompare));
+                } else if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode[i])) {
+                    if (b->command == vmParse::FunctionCommand::CALL) {
+                        Costs costs {
+                            words(vmRoutines::callSite(b->name, b->value, "label", scratch)),
+                            words(vmRoutines::routine("call")),
+                            words(vmRoutines::inlineCall(b->name, b->value, "label"))
+                        };
+                        b->placement = vmParse::SHARED;
+                        sites.push_back(site(u, i, "call", costs, hotness[u][i], false));
+                    } else if (b->command == vmParse::FunctionCommand::RETURN) {
+                        Costs costs {words(vmRoutines::returnSite(scratch)), words(vmRoutines::routine("return")), words(vmRoutines::inlineReturn())};
+                        b->placement = vmParse::SHARED;
+                        sites.push_back(site(u, i, "return", costs, hotness[u][i], false));
+                    }
+                }
+            }
+        }
+        return sites;
+    }
+
+    void place(vmParse::Bytecode &bytecode, vmParse::Placement placement) {
+        if (auto b = std::get_if<vmParse::LogicBytecode>(&bytecode)) { b->placement = placement; }
+        if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode)) { b->placement = placement; }
+    }
+
+    std::vector<bool> choose(const std::vector<Site> &sites, unsigned int spare) {
+        std::vector<bool> chosen(sites.size());
+        unsigned int total = 0;
+        for (const auto &s : sites) { total += s.words; }
+
+        if (total <= spare) {
+            chosen.assign(sites.size(), true);
+        } else {
+            // best[c] is the most a choice among the sites so far saves in c
+            // words; taken[i][c] says whether that choice took site i.
+            std::vector<double> best(spare + 1);
+            std::vector<std::vector<bool>> taken(sites.size(), std::vector<bool>(spare + 1));
+            for (size_t i = 0; i < sites.size(); i++) {
+                auto value = sites[i].cycles * sites[i].hotness;
+                for (int c = spare; c >= static_cast<int>(sites[i].words); c--) {
+                    if (best[c - sites[i].words] + value > best[c]) {
+                        best[c] = best[c - sites[i].words] + value;
+                        taken[i][c] = true;
+                    }
+                }
+            }
+            unsigned int c = spare;
+            for (size_t i = sites.size(); i-- > 0;) {
+                if (taken[i][c]) {
+                    chosen[i] = true;
+                    c -= sites[i].words;
+                }
+            }
+        }
+        return chosen;
+    }
+
+    void inlineWithin(vmProgram::Program &program, const std::vector<Site> &sites, unsigned int spare, BudgetReport &report) {
+        auto chosen = choose(sites, spare);
+        for (size_t i = 0; i < sites.size(); i++) {
+            auto &count = report.sites[sites[i].name];
+            count.first++;
+            if (sites[i].inlinedByDefault) { report.defaultCyclesSaved += sites[i].cycles * sites[i].hotness; }
+            if (!chosen[i]) { continue; }
+            count.second++;
+            report.cyclesSaved += sites[i].cycles * sites[i].hotness;
+            place(program[sites[i].unit].bytecode[sites[i].index], vmParse::INLINE);
+        }
+    }
+
+    void print(const BudgetReport &report, std::ostream &out) {
+        out << "ROM budget" << std::endl << "==========" << std::endl;
+        for (const auto &[name, count] : report.sites) {
+            out << boost::format("%-8s %d of %d sites inline") % name % count.second % count.first << std::endl;
+        }
+        out << boost::format("%d words with every site shared, %d of %d used") % report.sharedWords % report.words % report.budget << std::endl;
+        out << boost::format("%.0f cycles saved, each inlined site's saving times its hotness") % report.cyclesSaved << std::endl;
+        out << boost::format("%.0f more than the default placement would save") % (report.cyclesSaved - report.defaultCyclesSaved) << std::endl << std::endl;
+    }
+}
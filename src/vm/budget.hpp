@@ -0,0 +1,72 @@
+#pragma once
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "parse.hpp"
+#include "program.hpp"
+#include "vm.hpp"
+
+namespace vmBudget {
+    // How often each command of each unit is expected to run, relative to
+    // the others, indexed like the program.
+    using Hotness = std::vector<std::vector<double>>;
+
+    // A loop runs from a label to the last jump back to it in the same
+    // function; start and end are the indices of the two.
+    struct Loop {
+        std::string function;
+        std::string label;
+        size_t start;
+        size_t end;
+    };
+
+    std::vector<Loop> findLoops(const std::vector<vmParse::Bytecode> &bytecode);
+
+    // 10 to the power of each command's loop depth.
+    Hotness loopHotness(const vmProgram::Program &program);
+
+    // A command that can be translated inline or through a shared routine,
+    // with the words inlining it costs and the cycles that saves each time
+    // it runs.
+    struct Site {
+        size_t unit;
+        size_t index;
+        std::string name;
+        unsigned int words;
+        unsigned int cycles;
+        double hotness;
+        // Whether the default placement inlines it: the options alone, or
+        // under a profile with a budget, the budget going by loop depth.
+        bool inlinedByDefault;
+    };
+
+    // Every site of program that the translator options leave a choice at,
+    // each set to SHARED, so the program is as small as it gets.
+    std::vector<Site> shareAll(vmProgram::Program &program, const vm::Options &options, const Hotness &hotness);
+
+    struct BudgetReport {
+        unsigned int budget = 0;
+        // Words with every site shared, and with the chosen sites inlined.
+        unsigned int sharedWords = 0;
+        unsigned int words = 0;
+        // Sites, and how many of them were inlined, keyed by routine name.
+        std::map<std::string, std::pair<unsigned int, unsigned int>> sites;
+        // Cycles saved per run of each inlined site, times its hotness, and
+        // the same for the sites the default placement inlines.
+        double cyclesSaved = 0;
+        double defaultCyclesSaved = 0;
+    };
+
+    // The sites that together save the most cycles, weighted by hotness,
+    // in at most spare words: a 0/1 knapsack over the sites.
+    std::vector<bool> choose(const std::vector<Site> &sites, unsigned int spare);
+
+    // Inline the sites choose picks.
+    void inlineWithin(vmProgram::Program &program, const std::vector<Site> &sites, unsigned int spare, BudgetReport &report);
+
+    void print(const BudgetReport &report, std::ostream &out = std::cout);
+}
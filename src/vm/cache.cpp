@@ -0,0 +1,465 @@
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "cache.hpp"
+#include "routines.hpp"
+
+/*
+Stack state tracking
+
+The plain translator writes every result back to RAM and the next command
+immediately reads it again, and every push and pop updates SP in RAM. Here
+both are tracked at compile time instead.
+
+Top-of-stack caching (cacheTop): the logical top of the stack may live in D.
+Commands that need it pop it into D if it isn't already there, and pushes
+spill D before loading the new value.
+
+Virtual SP (virtualSp): the real stack pointer is RAM[SP] + offset. Slots are
+addressed relative to RAM[SP] with A=M+1 / A=M-1 chains, so offsets are kept
+within maxOffset; past that, or at a block exit, the offset is written back.
+
+Taken together, memory holds the stack up to RAM[SP] + offset, and when inD
+is set D is the value that belongs in that slot. Everything is flushed back
+to plain form at the end of the sequence and before every label and jump,
+so that every entry point sees the stack entirely in RAM. A conditional
+jump consumes D as its condition, so only the offset needs writing back.
+*/
+
+namespace vmCache {
+    const int maxOffset = 3;
+
+    struct State {
+        bool inD = false;
+        int offset = 0;
+        unsigned int currentLabel = 0;
+        // Flow labels and return addresses are scoped to the function.
+        std::string scope;
+        vmRoutines::Usage &usage;
+    };
+
+    void emit(std::vector<std::string> &result, std::initializer_list<std::string> lines) {
+        result.insert(result.end(), lines);
+    }
+
+    // Leave A pointing at RAM[SP] + slot using only A.
+    void addressSlot(std::vector<std::string> &result, int slot) {
+        result.push_back("@SP");
+        if (slot == 0) {
+            result.push_back("A=M");
+            return;
+        }
+        result.push_back(slot > 0 ? "A=M+1" : "A=M-1");
+        for (int i = 1; i < std::abs(slot); i++) {
+            result.push_back(slot > 0 ? "A=A+1" : "A=A-1");
+        }
+    }
+
+    // Write the offset back to RAM[SP] without touching D.
+    void writeBackSp(std::vector<std::string> &result, State &state) {
+        if (state.offset == 0) { return; }
+        result.push_back("@SP");
+        for (int i = 0; i < std::abs(state.offset); i++) {
+            result.push_back(state.offset > 0 ? "M=M+1" : "M=M-1");
+        }
+        state.offset = 0;
+    }
+
+    void spill(std::vector<std::string> &result, State &state, const vm::Options &options) {
+        if (!state.inD) { return; }
+        state.inD = false;
+        if (options.virtualSp) {
+            addressSlot(result, state.offset);
+            result.push_back("M=D");
+            state.offset++;
+            if (state.offset > maxOffset) { writeBackSp(result, state); }
+        } else {
+            emit(result, {"@SP", "M=M+1", "A=M-1", "M=D"});
+        }
+    }
+
+    void flush(std::vector<std::string> &result, State &state, const vm::Options &options) {
+        spill(result, state, options);
+        writeBackSp(result, state);
+    }
+
+    // Leave A pointing at the topmost value held in memory and drop it from
+    // the stack, so the caller can combine it with D through M.
+    void popAddress(std::vector<std::string> &result, State &state, const vm::Options &options) {
+        if (options.virtualSp) {
+            if (state.offset - 1 < -maxOffset) { writeBackSp(result, state); }
+            addressSlot(result, state.offset - 1);
+            state.offset--;
+        } else {
+            emit(result, {"@SP", "AM=M-1"});
+        }
+    }
+
+    void popToD(std::vector<std::string> &result, State &state, const vm::Options &options) {
+        if (state.inD) { return; }
+        popAddress(result, state, options);
+        result.push_back("D=M");
+        state.inD = true;
+    }
+
+    std::string segmentBase(vmParse::MemorySegment segment) {
+        switch(segment) {
+            case vmParse::MemorySegment::LOCAL: return "LCL";
+            case vmParse::MemorySegment::ARGUMENT: return "ARG";
+            case vmParse::MemorySegment::THIS: return "THIS";
+            case vmParse::MemorySegment::THAT: return "THAT";
+            default:
+                throw std::out_of_range("Segment has no base pointer");
+        }
+    }
+
+    // Segments whose address is known at assembly time: static, temp,
+    // pointer and absolute. Returns the symbol or number to use in an A-instruction.
+    std::string fixedAddress(const vmParse::MemoryBytecode &bytecode, const std::string &file_namespace) {
+        switch(bytecode.segment) {
+            case vmParse::MemorySegment::STATIC:
+                return file_namespace + "." + std::to_string(bytecode.value);
+            case vmParse::MemorySegment::TEMP:
+                return std::to_string(5 + bytecode.value);
+            case vmParse::MemorySegment::POINTER:
+                return std::to_string(3 + bytecode.value);
+            case vmParse::MemorySegment::ABSOLUTE:
+                return std::to_string(bytecode.value);
+            default:
+                return "";
+        }
+    }
+
+    // Leave A pointing at base[value] using only A, for small offsets.
+    void addressByIncrement(std::vector<std::string> &result, const std::string &base, unsigned int value) {
+        result.push_back("@" + base);
+        result.push_back(value == 0 ? "A=M" : "A=M+1");
+        for (unsigned int i = 1; i < value; i++) {
+            result.push_back("A=A+1");
+        }
+    }
+
+    void loadToD(std::vector<std::string> &result, const vmParse::MemoryBytecode &bytecode, const std::string &file_namespace) {
+        if (bytecode.segment == vmParse::MemorySegment::CONSTANT) {
+            if (bytecode.value <= 1) {
+                result.push_back("D=" + std::to_string(bytecode.value));
+            } else {
+                emit(result, {"@" + std::to_string(bytecode.value), "D=A"});
+            }
+            return;
+        }
+
+        if (auto address = fixedAddress(bytecode, file_namespace); !address.empty()) {
+            emit(result, {"@" + address, "D=M"});
+            return;
+        }
+
+        auto base = segmentBase(bytecode.segment);
+        if (bytecode.value <= 2) {
+            addressByIncrement(result, base, bytecode.value);
+            result.push_back("D=M");
+        } else {
+            emit(result, {"@" + base, "D=M", "@" + std::to_string(bytecode.value), "A=D+A", "D=M"});
+        }
+    }
+
+    void storeFromD(std::vector<std::string> &result, const vmParse::MemoryBytecode &bytecode, const std::string &file_namespace,
+                    const std::string &comp) {
+        if (bytecode.segment == vmParse::MemorySegment::CONSTANT) {
+            throw std::out_of_range("Cannot pop constant");
+        }
+
+        if (auto address = fixedAddress(bytecode, file_namespace); !address.empty()) {
+            emit(result, {"@" + address, "M=" + comp});
+            return;
+        }
+
+        auto base = segmentBase(bytecode.segment);
+        if (bytecode.value <= 8) {
+            addressByIncrement(result, base, bytecode.value);
+            result.push_back("M=" + comp);
+        } else {
+            // D holds the value and we need it alongside the address without
+            // a second scratch register: keep the value in R13, fold the
+            // address into D, then separate the two again with A=D-M, D=D-A.
+            if (comp != "D") { result.push_back("D=" + comp); }
+            emit(result, {
+                "@R13", "M=D", "@" + base, "D=D+M", "@" + std::to_string(bytecode.value), "D=D+A",
+                "@R13", "A=D-M", "D=D-A", "M=D"
+            });
+        }
+    }
+
+    std::vector<std::string> moveToStrings(const vmParse::MoveBytecode &bytecode, const std::string &file_namespace) {
+        std::vector<std::string> result;
+        if (bytecode.fromSegment == bytecode.toSegment && bytecode.fromValue == bytecode.toValue) {
+            return result;
+        }
+
+        vmParse::MemoryBytecode from {vmParse::MemoryCommand::PUSH, bytecode.fromSegment, bytecode.fromValue};
+        vmParse::MemoryBytecode to {vmParse::MemoryCommand::POP, bytecode.toSegment, bytecode.toValue};
+        if (from.segment == vmParse::MemorySegment::CONSTANT && from.value <= 1) {
+            // 0 and 1 are available as comps, so D isn't needed.
+            storeFromD(result, to, file_namespace, std::to_string(from.value));
+        } else {
+            loadToD(result, from, file_namespace);
+            storeFromD(result, to, file_namespace);
+        }
+        return result;
+    }
+
+    // Leave the address of base[index] in D, using R15 when the index slot
+    // can't be reached with A alone.
+    void elementAddressToD(std::vector<std::string> &result, const vmParse::ArrayBytecode &bytecode, const std::string &file_namespace) {
+        vmParse::MemoryBytecode base {vmParse::MemoryCommand::PUSH, bytecode.baseSegment, bytecode.baseValue};
+        vmParse::MemoryBytecode index {vmParse::MemoryCommand::PUSH, bytecode.indexSegment, bytecode.indexValue};
+        loadToD(result, base, file_namespace);
+
+        if (index.segment == vmParse::MemorySegment::CONSTANT) {
+            if (index.value == 1) {
+                result.push_back("D=D+1");
+            } else if (index.value > 1) {
+                emit(result, {"@" + std::to_string(index.value), "D=D+A"});
+            }
+        } else if (auto address = fixedAddress(index, file_namespace); !address.empty()) {
+            emit(result, {"@" + address, "D=D+M"});
+        } else if (index.value <= 2) {
+            addressByIncrement(result, segmentBase(index.segment), index.value);
+            result.push_back("D=D+M");
+        } else {
+            emit(result, {"@R15", "M=D"});
+            loadToD(result, index, file_namespace);
+            emit(result, {"@R15", "D=D+M"});
+        }
+    }
+
+    void loadElementToD(std::vector<std::string> &result, const vmParse::ArrayBytecode &bytecode, const std::string &file_namespace) {
+        elementAddressToD(result, bytecode, file_namespace);
+        if (bytecode.setsThat) { emit(result, {"@THAT", "M=D"}); }
+        emit(result, {"A=D", "D=M"});
+    }
+
+    // The value waits in temp 0 or R13 while the address is worked out, and
+    // the address in THAT or R14 while the value is fetched back.
+    void storeElementFromD(std::vector<std::string> &result, const vmParse::ArrayBytecode &bytecode, const std::string &file_namespace) {
+        std::string value = bytecode.setsTemp ? "5" : "R13";
+        std::string address = bytecode.setsThat ? "THAT" : "R14";
+        emit(result, {"@" + value, "M=D"});
+        elementAddressToD(result, bytecode, file_namespace);
+        emit(result, {"@" + address, "M=D", "@" + value, "D=M", "@" + address, "A=M", "M=D"});
+    }
+
+    void translate(std::vector<std::string> &result, const vmParse::LogicBytecode &bytecode, State &state,
+                   const std::string &file_namespace, const vm::Options &options) {
+        switch(bytecode.command) {
+            case vmParse::LogicCommand::NEG:
+            case vmParse::LogicCommand::NOT: {
+                auto op = bytecode.command == vmParse::LogicCommand::NEG ? "-" : "!";
+                if (state.inD) {
+                    result.push_back(std::string("D=") + op + "D");
+                } else {
+                    popAddress(result, state, options);
+                    result.push_back(std::string("D=") + op + "M");
+                    state.inD = true;
+                }
+                return;
+            }
+            default:
+                break;
+        }
+
+        // Binary operators: y is in D, x is the next value down in memory.
+        popToD(result, state, options);
+        popAddress(result, state, options);
+
+        switch(bytecode.command) {
+            case vmParse::LogicCommand::ADD:
+                result.push_back("D=D+M");
+                return;
+            case vmParse::LogicCommand::SUB:
+                result.push_back("D=M-D");
+                return;
+            case vmParse::LogicCommand::AND:
+                result.push_back("D=D&M");
+                return;
+            case vmParse::LogicCommand::OR:
+                result.push_back("D=D|M");
+                return;
+            case vmParse::LogicCommand::EQ: {
+                // x-y is zero exactly when equal; 0 becomes -1 and any
+                // other value becomes 1, then 0, after the decrement.
+                auto label = file_namespace + "_eqlabel_" + std::to_string(++state.currentLabel);
+                emit(result, {"D=M-D", "@" + label, "D;JEQ", "D=1", "(" + label + ")", "D=D-1"});
+                return;
+            }
+            case vmParse::LogicCommand::GT:
+            case vmParse::LogicCommand::LT: {
+                auto name = bytecode.command == vmParse::LogicCommand::GT ? "gt" : "lt";
+                auto jump = bytecode.command == vmParse::LogicCommand::GT ? "D;JGT" : "D;JLT";
+                auto label = file_namespace + "_" + name + "label_" + std::to_string(++state.currentLabel);
+                emit(result, {
+                    "D=M-D", "@" + label + "_true", jump, "D=0", "@" + label + "_end", "0;JMP",
+                    "(" + label + "_true)", "D=-1", "(" + label + "_end)"
+                });
+                return;
+            }
+            default:
+                throw std::out_of_range("Unreachable condition");
+        }
+    }
+
+    std::string flowLabel(const std::string &scope, const std::string &label) {
+        return scope + "$" + label;
+    }
+
+    std::string branchJump(const vmParse::CompareBranchBytecode &bytecode) {
+        switch(bytecode.command) {
+            case vmParse::LogicCommand::EQ: return bytecode.negated ? "D;JNE" : "D;JEQ";
+            case vmParse::LogicCommand::GT: return bytecode.negated ? "D;JLE" : "D;JGT";
+            case vmParse::LogicCommand::LT: return bytecode.negated ? "D;JGE" : "D;JLT";
+            default:
+                throw std::out_of_range("Not a comparison");
+        }
+    }
+
+    void mark(std::vector<sourceMap::Mark> *marks, const std::vector<std::string> &result, const vmParse::Bytecode &bytecode,
+              const std::string &scope) {
+        if (!marks) { return; }
+        auto function = std::get_if<vmParse::FunctionBytecode>(&bytecode);
+        marks->push_back({result.size(), vmParse::lineOf(bytecode), function && function->command == vmParse::FunctionCommand::FUNCTION ? function->name : scope});
+    }
+
+    void translate(std::vector<std::string> &result, const vmParse::FlowBytecode &bytecode, State &state,
+                   const std::string &file_namespace, const vm::Options &options) {
+        auto label = flowLabel(state.scope, bytecode.label);
+        switch(bytecode.command) {
+            case vmParse::FlowCommand::LABEL:
+                flush(result, state, options);
+                result.push_back("(" + label + ")");
+                return;
+            case vmParse::FlowCommand::GOTO:
+                flush(result, state, options);
+                emit(result, {"@" + label, "0;JMP"});
+                return;
+            case vmParse::FlowCommand::IF_GOTO:
+                popToD(result, state, options);
+                state.inD = false;
+                writeBackSp(result, state);
+                emit(result, {"@" + label, "D;JNE"});
+                return;
+            default:
+                throw std::out_of_range("Unreachable condition");
+        }
+    }
+
+    void translate(std::vector<std::string> &result, const vmParse::CompareBranchBytecode &bytecode, State &state,
+                   const std::string &file_namespace, const vm::Options &options) {
+        popToD(result, state, options);
+        popAddress(result, state, options);
+        result.push_back("D=M-D");
+        state.inD = false;
+        writeBackSp(result, state);
+        emit(result, {"@" + flowLabel(state.scope, bytecode.label), branchJump(bytecode)});
+    }
+
+    // Function entry, call and return go through the frame in RAM, so the
+    // stack is flushed to plain form first.
+    void translate(std::vector<std::string> &result, const vmParse::FunctionBytecode &bytecode, State &state,
+                   const std::string &file_namespace, const vm::Options &options) {
+        flush(result, state, options);
+        std::vector<std::string> lines;
+        switch(bytecode.command) {
+            case vmParse::FunctionCommand::FUNCTION:
+                state.scope = bytecode.name;
+                lines = vmRoutines::functionEntry(bytecode.name, bytecode.value);
+                break;
+            case vmParse::FunctionCommand::CALL: {
+                auto returnLabel = state.scope + "$ret." + std::to_string(++state.currentLabel);
+                lines = bytecode.placement == vmParse::INLINE
+                    ? vmRoutines::inlineCall(bytecode.name, bytecode.value, returnLabel)
+                    : vmRoutines::callSite(bytecode.name, bytecode.value, returnLabel, state.usage);
+                break;
+            }
+            case vmParse::FunctionCommand::RETURN:
+                lines = bytecode.placement == vmParse::INLINE ? vmRoutines::inlineReturn() : vmRoutines::returnSite(state.usage);
+                break;
+            case vmParse::FunctionCommand::TAIL_CALL:
+                lines = vmRoutines::tailCallSite(bytecode.name, bytecode.value, state.usage);
+                break;
+            default:
+                throw std::out_of_range("Unreachable condition");
+        }
+        result.insert(result.end(), lines.begin(), lines.end());
+    }
+
+    // Only A changes, so the cached top stays in D.
+    void translate(std::vector<std::string> &result, const vmParse::CountBytecode &bytecode, State &state,
+                   const std::string &file_namespace, const vm::Options &options) {
+        emit(result, {"@" + std::to_string(bytecode.address), "M=M+1"});
+    }
+
+    void translate(std::vector<std::string> &result, const vmParse::MoveBytecode &bytecode, State &state,
+                   const std::string &file_namespace, const vm::Options &options) {
+        spill(result, state, options);
+        auto moved = moveToStrings(bytecode, file_namespace);
+        result.insert(result.end(), moved.begin(), moved.end());
+    }
+
+    void translate(std::vector<std::string> &result, const vmParse::ArrayBytecode &bytecode, State &state,
+                   const std::string &file_namespace, const vm::Options &options) {
+        switch(bytecode.command) {
+            case vmParse::MemoryCommand::PUSH:
+                spill(result, state, options);
+                loadElementToD(result, bytecode, file_namespace);
+                state.inD = true;
+                return;
+            case vmParse::MemoryCommand::POP:
+                popToD(result, state, options);
+                storeElementFromD(result, bytecode, file_namespace);
+                state.inD = false;
+                return;
+            default:
+                throw std::out_of_range("Unreachable condition");
+        }
+    }
+
+    void translate(std::vector<std::string> &result, const vmParse::MemoryBytecode &bytecode, State &state,
+                   const std::string &file_namespace, const vm::Options &options) {
+        switch(bytecode.command) {
+            case vmParse::MemoryCommand::PUSH:
+                spill(result, state, options);
+                loadToD(result, bytecode, file_namespace);
+                state.inD = true;
+                return;
+            case vmParse::MemoryCommand::POP:
+                popToD(result, state, options);
+                storeFromD(result, bytecode, file_namespace);
+                state.inD = false;
+                return;
+            default:
+                throw std::out_of_range("Unreachable condition");
+        }
+    }
+
+    std::vector<std::string> translateToStrings(const std::vector<vmParse::Bytecode> &bytecodes, std::string file_namespace, const vm::Options &options,
+                                                vmRoutines::Usage &usage, unsigned int &currentLabel,
+                                                std::vector<sourceMap::Mark> *marks) {
+        State state {false, 0, currentLabel, file_namespace, usage};
+        std::vector<std::string> result;
+
+        for (const auto &bytecode : bytecodes) {
+            mark(marks, result, bytecode, state.scope);
+            std::visit([&](const auto &b) { translate(result, b, state, file_namespace, options); }, bytecode);
+            if (!options.cacheTop) {
+                spill(result, state, options);
+            }
+        }
+        flush(result, state, options);
+        currentLabel = state.currentLabel;
+
+        return result;
+    }
+}
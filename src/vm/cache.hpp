@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "parse.hpp"
+#include "routines.hpp"
+#include "sourcemap.hpp"
+#include "vm.hpp"
+
+namespace vmCache {
+    // Templates shared with the plain translator. loadToD leaves a segment
+    // slot's value in D; storeFromD stores comp (normally D) into one.
+    void loadToD(std::vector<std::string> &result, const vmParse::MemoryBytecode &bytecode, const std::string &file_namespace);
+    void storeFromD(std::vector<std::string> &result, const vmParse::MemoryBytecode &bytecode, const std::string &file_namespace,
+                    const std::string &comp = "D");
+    std::vector<std::string> moveToStrings(const vmParse::MoveBytecode &bytecode, const std::string &file_namespace);
+    // loadElementToD leaves an array element in D; storeElementFromD stores
+    // D into one. Both may use R13-R15.
+    void loadElementToD(std::vector<std::string> &result, const vmParse::ArrayBytecode &bytecode, const std::string &file_namespace);
+    void storeElementFromD(std::vector<std::string> &result, const vmParse::ArrayBytecode &bytecode, const std::string &file_namespace);
+
+    // Labels from label/goto/if-goto live in the scope they were written in.
+    std::string flowLabel(const std::string &scope, const std::string &label);
+    // Jump taken on x-y for a fused compare and branch.
+    std::string branchJump(const vmParse::CompareBranchBytecode &bytecode);
+
+    // Note that the code for bytecode starts at the end of result, in scope
+    // or the function bytecode opens. Every command gets a mark, in order.
+    void mark(std::vector<sourceMap::Mark> *marks, const std::vector<std::string> &result, const vmParse::Bytecode &bytecode,
+              const std::string &scope);
+
+    // Translate with the stack state tracked at compile time: the top of the
+    // stack kept in D (options.cacheTop) and/or SP kept as an offset from the
+    // value in RAM (options.virtualSp). Both are written back to RAM at the
+    // end of the sequence. Shared routines the code calls are added to usage,
+    // and currentLabel carries label numbering on from earlier sequences.
+    // marks, if given, gets where each command's code starts.
+    std::vector<std::string> translateToStrings(const std::vector<vmParse::Bytecode> &bytecodes, std::string file_namespace, const vm::Options &options,
+                                                vmRoutines::Usage &usage, unsigned int &currentLabel,
+                                                std::vector<sourceMap::Mark> *marks = nullptr);
+}
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "cost.hpp"
+#include "overloaded.hpp"
+
+/*
+Static cost
+
+The words each command costs are read off the code the translator actually
+emitted for it, so templates, idioms and the stack caching all count as they
+do in the output.
+*/
+
+namespace vmCost {
+    const size_t topIdioms = 10;
+
+    // A command with its operands left out.
+    std::string shape(const vmParse::Bytecode &bytecode) {
+        return std::visit(overloaded {
+            [](const vmParse::LogicBytecode &l) { return vmParse::commandName(l.command); },
+            [](const vmParse::MemoryBytecode &m) {
+                return std::string(m.command == vmParse::MemoryCommand::PUSH ? "push " : "pop ") + vmParse::segmentName(m.segment);
+            },
+            [](const vmParse::MoveBytecode &m) {
+                return "move " + vmParse::segmentName(m.fromSegment) + " -> " + vmParse::segmentName(m.toSegment);
+            },
+            [](const vmParse::FlowBytecode &f) {
+                switch(f.command) {
+                    case vmParse::FlowCommand::LABEL: return std::string("label");
+                    case vmParse::FlowCommand::GOTO: return std::string("goto");
+                    case vmParse::FlowCommand::IF_GOTO: return std::string("if-goto");
+                    default: throw std::out_of_range("Unreachable condition");
+                }
+            },
+            [](const vmParse::FunctionBytecode &f) {
+                switch(f.command) {
+                    case vmParse::FunctionCommand::FUNCTION: return std::string("function");
+                    case vmParse::FunctionCommand::CALL: return std::string("call");
+                    case vmParse::FunctionCommand::RETURN: return std::string("return");
+                    case vmParse::FunctionCommand::TAIL_CALL: return std::string("tail call");
+                    default: throw std::out_of_range("Unreachable condition");
+                }
+            },
+            [](const vmParse::CompareBranchBytecode &c) {
+                return vmParse::commandName(c.command) + (c.negated ? " not" : "") + " if-goto";
+            },
+            [](const vmParse::CountBytecode &) { return std::string("count"); },
+            [](const vmParse::ArrayBytecode &a) {
+                return std::string(a.command == vmParse::MemoryCommand::PUSH ? "array load " : "array store ") + vmParse::segmentName(a.baseSegment);
+            },
+        }, bytecode);
+    }
+
+    void add(CostReport &report, const std::string &file, const std::vector<vmParse::Bytecode> &bytecode,
+             const std::vector<std::string> &lines, const std::vector<sourceMap::Mark> &marks) {
+        if (marks.size() != bytecode.size()) {
+            throw std::out_of_range("Expected one mark per command");
+        }
+
+        std::vector<std::string> shapes;
+        std::vector<unsigned int> words;
+        auto closeFunction = [&]() {
+            for (size_t n = 2; n <= 3; n++) {
+                for (size_t i = 0; i + n <= shapes.size(); i++) {
+                    std::string idiom = shapes[i];
+                    unsigned int total = words[i];
+                    for (size_t j = i + 1; j < i + n; j++) {
+                        idiom += "; " + shapes[j];
+                        total += words[j];
+                    }
+                    report.idioms[idiom].count++;
+                    report.idioms[idiom].words += total;
+                }
+            }
+            shapes.clear();
+            words.clear();
+        };
+
+        for (size_t i = 0; i < bytecode.size(); i++) {
+            const auto &mark = marks[i];
+            auto end = i + 1 < marks.size() ? lines.begin() + marks[i + 1].index : lines.end();
+            unsigned int cost = std::count_if(lines.begin() + mark.index, end, [](const std::string &line) { return line[0] != '('; });
+
+            if (report.functions.empty() || report.functions.back().file != file || report.functions.back().function != mark.function) {
+                closeFunction();
+                report.functions.push_back({file, mark.function});
+            }
+            auto &function = report.functions.back();
+            auto name = shape(bytecode[i]);
+            function.words += cost;
+            function.commands[name].count++;
+            function.commands[name].words += cost;
+            shapes.push_back(name);
+            words.push_back(cost);
+        }
+        closeFunction();
+    }
+
+    void merge(CostReport &into, const CostReport &from) {
+        into.functions.insert(into.functions.end(), from.functions.begin(), from.functions.end());
+        for (const auto &[idiom, tally] : from.idioms) {
+            into.idioms[idiom].count += tally.count;
+            into.idioms[idiom].words += tally.words;
+        }
+        into.bootstrapWords += from.bootstrapWords;
+        into.routineWords += from.routineWords;
+    }
+
+    // Files in the order they were translated, with their words.
+    std::vector<std::pair<std::string, unsigned int>> fileWords(const CostReport &report) {
+        std::vector<std::pair<std::string, unsigned int>> result;
+        for (const auto &function : report.functions) {
+            if (result.empty() || result.back().first != function.file) { result.emplace_back(function.file, 0); }
+            result.back().second += function.words;
+        }
+        return result;
+    }
+
+    std::map<std::string, Tally> commandTotals(const CostReport &report) {
+        std::map<std::string, Tally> result;
+        for (const auto &function : report.functions) {
+            for (const auto &[name, tally] : function.commands) {
+                result[name].count += tally.count;
+                result[name].words += tally.words;
+            }
+        }
+        return result;
+    }
+
+    // Most words first, ties by name, so the order is stable.
+    template <typename Entry, typename Words, typename Name>
+    void sortByWords(std::vector<Entry> &entries, Words words, Name name) {
+        std::sort(entries.begin(), entries.end(), [&](const Entry &a, const Entry &b) {
+            return words(a) != words(b) ? words(a) > words(b) : name(a) < name(b);
+        });
+    }
+
+    std::vector<std::pair<std::string, Tally>> sortedTallies(const std::map<std::string, Tally> &tallies) {
+        std::vector<std::pair<std::string, Tally>> result(tallies.begin(), tallies.end());
+        sortByWords(result, [](const auto &e) { return e.second.words; }, [](const auto &e) { return e.first; });
+        return result;
+    }
+
+    unsigned int totalWords(const CostReport &report) {
+        unsigned int total = report.bootstrapWords + report.routineWords;
+        for (const auto &function : report.functions) { total += function.words; }
+        return total;
+    }
+
+    void print(const CostReport &report, std::ostream &out) {
+        out << "Cost by file" << std::endl << "==========" << std::endl;
+        for (const auto &[file, words] : fileWords(report)) {
+            out << boost::format("%-40s %6d words") % file % words << std::endl;
+        }
+        if (report.bootstrapWords) { out << boost::format("%-40s %6d words") % "bootstrap" % report.bootstrapWords << std::endl; }
+        if (report.routineWords) { out << boost::format("%-40s %6d words") % "shared routines" % report.routineWords << std::endl; }
+        out << boost::format("%d words") % totalWords(report) << std::endl << std::endl;
+
+        out << "Cost by function" << std::endl << "==========" << std::endl;
+        auto functions = report.functions;
+        sortByWords(functions, [](const FunctionCost &f) { return f.words; }, [](const FunctionCost &f) { return f.file + f.function; });
+        for (const auto &function : functions) {
+            out << boost::format("%-30s %6d words  %s") % function.function % function.words % function.file << std::endl;
+        }
+        out << std::endl;
+
+        out << "Cost by command" << std::endl << "==========" << std::endl;
+        for (const auto &[name, tally] : sortedTallies(commandTotals(report))) {
+            out << boost::format("%-30s %6d commands %7d words %6.1f each")
+                % name % tally.count % tally.words % (static_cast<double>(tally.words) / tally.count) << std::endl;
+        }
+        out << std::endl;
+
+        out << "Top idioms" << std::endl << "==========" << std::endl;
+        auto idioms = sortedTallies(report.idioms);
+        for (size_t i = 0; i < std::min(topIdioms, idioms.size()); i++) {
+            out << boost::format("%-50s %6d times %7d words") % idioms[i].first % idioms[i].second.count % idioms[i].second.words << std::endl;
+        }
+        out << std::endl;
+    }
+
+    std::string quote(const std::string &s) {
+        std::string result = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+                result += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                result += (boost::format("\\u%04x") % static_cast<int>(c)).str();
+            } else {
+                result += c;
+            }
+        }
+        return result + "\"";
+    }
+
+    void printJson(const std::map<std::string, Tally> &tallies, std::ostream &out) {
+        out << "{";
+        bool first = true;
+        for (const auto &[name, tally] : tallies) {
+            out << (first ? "" : ", ") << quote(name) << ": {\"count\": " << tally.count << ", \"words\": " << tally.words << "}";
+            first = false;
+        }
+        out << "}";
+    }
+
+    // The whole report, with the command breakdown of every function, in a
+    // fixed order so that runs can be diffed.
+    void printJson(const CostReport &report, std::ostream &out) {
+        out << "{" << std::endl;
+        out << "  \"words\": " << totalWords(report) << "," << std::endl;
+        out << "  \"bootstrapWords\": " << report.bootstrapWords << "," << std::endl;
+        out << "  \"routineWords\": " << report.routineWords << "," << std::endl;
+
+        out << "  \"files\": [";
+        auto files = fileWords(report);
+        for (size_t i = 0; i < files.size(); i++) {
+            out << (i ? "," : "") << std::endl << "    {\"file\": " << quote(files[i].first) << ", \"words\": " << files[i].second << "}";
+        }
+        out << std::endl << "  ]," << std::endl;
+
+        out << "  \"functions\": [";
+        for (size_t i = 0; i < report.functions.size(); i++) {
+            const auto &function = report.functions[i];
+            out << (i ? "," : "") << std::endl << "    {\"file\": " << quote(function.file) << ", \"function\": " << quote(function.function)
+                << ", \"words\": " << function.words << ", \"commands\": ";
+            printJson(function.commands, out);
+            out << "}";
+        }
+        out << std::endl << "  ]," << std::endl;
+
+        out << "  \"commands\": ";
+        printJson(commandTotals(report), out);
+        out << "," << std::endl;
+
+        out << "  \"idioms\": [";
+        auto idioms = sortedTallies(report.idioms);
+        for (size_t i = 0; i < std::min(topIdioms, idioms.size()); i++) {
+            out << (i ? "," : "") << std::endl << "    {\"idiom\": " << quote(idioms[i].first) << ", \"count\": " << idioms[i].second.count
+                << ", \"words\": " << idioms[i].second.words << "}";
+        }
+        out << std::endl << "  ]" << std::endl << "}" << std::endl;
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "parse.hpp"
+#include "sourcemap.hpp"
+
+namespace vmCost {
+    // How many commands of a kind there were, and the words they took.
+    struct Tally {
+        unsigned int count = 0;
+        unsigned int words = 0;
+    };
+
+    struct FunctionCost {
+        std::string file;
+        std::string function;
+        unsigned int words = 0;
+        // Keyed by command shape: "push local", "call", "eq", ...
+        std::map<std::string, Tally> commands;
+    };
+
+    struct CostReport {
+        // In translation order.
+        std::vector<FunctionCost> functions;
+        // Runs of two and three consecutive command shapes within a function,
+        // "push constant; add" and so on.
+        std::map<std::string, Tally> idioms;
+        unsigned int bootstrapWords = 0;
+        unsigned int routineWords = 0;
+    };
+
+    // Charge each command the words its code took in lines, as found by the
+    // marks the translator left, one per command of bytecode.
+    void add(CostReport &report, const std::string &file, const std::vector<vmParse::Bytecode> &bytecode,
+             const std::vector<std::string> &lines, const std::vector<sourceMap::Mark> &marks);
+    void merge(CostReport &into, const CostReport &from);
+
+    void print(const CostReport &report, std::ostream &out = std::cout);
+    void printJson(const CostReport &report, std::ostream &out);
+}
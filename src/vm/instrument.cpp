@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "instrument.hpp"
+
+/*
+Instrumentation
+
+Each counter is one RAM word, bumped with @address, M=M+1, which leaves D and
+the stack alone, so counters can go between any two commands of either
+translator. Counts wrap at 65536.
+*/
+
+namespace vmInstrument {
+    bool isFunction(const vmParse::Bytecode &bytecode) {
+        auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode);
+        return b && b->command == vmParse::FunctionCommand::FUNCTION;
+    }
+
+    // Execution never carries on past bytecode.
+    bool endsFlow(const vmParse::Bytecode &bytecode) {
+        if (auto b = std::get_if<vmParse::FlowBytecode>(&bytecode)) { return b->command == vmParse::FlowCommand::GOTO; }
+        if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode)) {
+            return b->command == vmParse::FunctionCommand::RETURN || b->command == vmParse::FunctionCommand::TAIL_CALL;
+        }
+        return false;
+    }
+
+    std::vector<vmParse::Bytecode> instrument(const std::vector<vmParse::Bytecode> &bytecodes, const std::string &file, Counters &counters) {
+        std::vector<vmParse::Bytecode> result;
+        std::vector<vmParse::Bytecode> stubs;
+        std::string function;
+        std::set<std::string> labels;
+        // Set while the last command was this label.
+        std::string justLabelled;
+
+        auto count = [&](const std::string &label, unsigned int line) {
+            if (top - counters.size() < lowest) {
+                throw std::out_of_range("Too many counters to fit in the static area");
+            }
+            auto address = top - static_cast<unsigned int>(counters.size());
+            counters.push_back({function, label, file, line});
+            return vmParse::CountBytecode {address, line};
+        };
+
+        // Stubs go after the function, behind a jump if it can run off its end.
+        auto placeStubs = [&]() {
+            if (stubs.empty()) { return; }
+            auto skip = std::get<vmParse::FlowBytecode>(stubs.front()).label + "_skip";
+            bool guard = result.empty() || !endsFlow(result.back());
+            if (guard) { result.push_back(vmParse::FlowBytecode {vmParse::FlowCommand::GOTO, skip}); }
+            result.insert(result.end(), stubs.begin(), stubs.end());
+            if (guard) { result.push_back(vmParse::FlowBytecode {vmParse::FlowCommand::LABEL, skip}); }
+            stubs.clear();
+        };
+
+        for (const auto &bytecode : bytecodes) {
+            if (isFunction(bytecode)) {
+                placeStubs();
+                const auto &b = std::get<vmParse::FunctionBytecode>(bytecode);
+                function = b.name;
+                labels.clear();
+                result.push_back(bytecode);
+                result.push_back(count("", b.line));
+                continue;
+            }
+
+            auto b = std::get_if<vmParse::FlowBytecode>(&bytecode);
+            auto previous = justLabelled;
+            justLabelled = b && b->command == vmParse::FlowCommand::LABEL ? b->label : "";
+            if (b && b->command == vmParse::FlowCommand::LABEL) {
+                labels.insert(b->label);
+            } else if (b && b->command == vmParse::FlowCommand::GOTO && b->label == previous) {
+                // label END; goto END is how a program halts. Counting it
+                // would only spin the counter, and hide the halt from
+                // emulators that look for a jump to itself.
+            } else if (b && labels.count(b->label) && b->command == vmParse::FlowCommand::GOTO) {
+                result.push_back(count(b->label, b->line));
+            } else if (b && labels.count(b->label) && b->command == vmParse::FlowCommand::IF_GOTO) {
+                auto counter = count(b->label, b->line);
+                auto stub = "__vm_count_" + std::to_string(counters.size() - 1);
+                stubs.push_back(vmParse::FlowBytecode {vmParse::FlowCommand::LABEL, stub, b->line});
+                stubs.push_back(counter);
+                stubs.push_back(vmParse::FlowBytecode {vmParse::FlowCommand::GOTO, b->label, b->line});
+                result.push_back(vmParse::FlowBytecode {vmParse::FlowCommand::IF_GOTO, stub, b->line});
+                continue;
+            }
+            result.push_back(bytecode);
+        }
+        placeStubs();
+
+        return result;
+    }
+
+    void addStatics(const std::vector<vmParse::Bytecode> &bytecode, const std::string &unit, Statics &statics) {
+        auto add = [&](vmParse::MemorySegment segment, unsigned int value) {
+            if (segment == vmParse::MemorySegment::STATIC) {
+                statics.symbols.insert(unit + "." + std::to_string(value));
+            } else if (segment == vmParse::MemorySegment::ABSOLUTE && value >= lowest && value <= top) {
+                statics.end = std::max(statics.end, value + 1);
+            }
+        };
+        for (const auto &b : bytecode) {
+            if (auto memory = std::get_if<vmParse::MemoryBytecode>(&b)) {
+                add(memory->segment, memory->value);
+            } else if (auto move = std::get_if<vmParse::MoveBytecode>(&b)) {
+                add(move->fromSegment, move->fromValue);
+                add(move->toSegment, move->toValue);
+            } else if (auto array = std::get_if<vmParse::ArrayBytecode>(&b)) {
+                add(array->baseSegment, array->baseValue);
+                add(array->indexSegment, array->indexValue);
+            }
+        }
+    }
+
+    void checkRoom(const Counters &counters, const Statics &statics) {
+        auto words = std::max<size_t>(statics.end - lowest, statics.symbols.size());
+        if (words + counters.size() > top - lowest + 1) {
+            throw std::out_of_range("Too many counters to fit in the static area: " + std::to_string(counters.size()) + " counters and " +
+                                    std::to_string(words) + " statics");
+        }
+    }
+
+    void write(const Counters &counters, const std::string &path) {
+        std::ofstream output_file(path, std::ofstream::out | std::ofstream::trunc);
+        if (!output_file.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+        for (size_t i = 0; i < counters.size(); i++) {
+            const auto &counter = counters[i];
+            output_file << top - i << ' '
+                        << (counter.function.empty() ? "-" : counter.function) << ' '
+                        << (counter.label.empty() ? "-" : counter.label) << ' '
+                        << counter.file << ':' << counter.line << '\n';
+        }
+    }
+
+    std::string countersPath(const std::string &output) {
+        return std::filesystem::path(output).replace_extension(".counters").string();
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "parse.hpp"
+
+namespace vmInstrument {
+    // Counters take words of the static area from the top down, and
+    // statics take it from the bottom up, so a counter never shares a word
+    // with a static, the stack or the heap.
+    const unsigned int top = 255;
+    const unsigned int lowest = 16;
+
+    // What a counter counts: calls to function when label is empty, else
+    // the times a jump back to label in function was taken.
+    struct Counter {
+        std::string function;
+        std::string label;
+        std::string file;
+        unsigned int line;
+    };
+
+    // Slot i is at address top - i.
+    using Counters = std::vector<Counter>;
+
+    // Count function entries, and jumps back to a label already seen in the
+    // same function, other than the jump of a halt loop. A taken if-goto is
+    // counted on its way through a stub placed after the function's code.
+    // New counters are added to counters, so slots carry on across files.
+    std::vector<vmParse::Bytecode> instrument(const std::vector<vmParse::Bytecode> &bytecodes, const std::string &file, Counters &counters);
+
+    // The statics of a program: symbols, which the assembler hands out from
+    // 16 up, and addresses --pack-statics already gave.
+    struct Statics {
+        std::set<std::string> symbols;
+        // One past the highest address given.
+        unsigned int end = lowest;
+    };
+
+    // Add the statics that bytecode of unit uses.
+    void addStatics(const std::vector<vmParse::Bytecode> &bytecode, const std::string &unit, Statics &statics);
+
+    // Throws if counters would take a word statics use.
+    void checkRoom(const Counters &counters, const Statics &statics);
+
+    // One counter per line: address, function, label (- for entries) and
+    // file:line, which runs to the end of the line.
+    void write(const Counters &counters, const std::string &path);
+
+    // The sidecar to go with an .asm or .hack output.
+    std::string countersPath(const std::string &output);
+}
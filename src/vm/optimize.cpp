@@ -0,0 +1,522 @@
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <variant>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "optimize.hpp"
+
+/*
+Bytecode-level optimization passes. Each pass takes a bytecode sequence and
+returns an equivalent one, filling in a report of what it changed.
+*/
+
+namespace vmOptimize {
+    std::vector<vmParse::Bytecode> fusePushPop(const std::vector<vmParse::Bytecode> &bytecodes, FusionReport &report) {
+        std::vector<vmParse::Bytecode> result;
+        result.reserve(bytecodes.size());
+
+        for (size_t i = 0; i < bytecodes.size(); i++) {
+            auto push = std::get_if<vmParse::MemoryBytecode>(&bytecodes[i]);
+            auto pop = i + 1 < bytecodes.size() ? std::get_if<vmParse::MemoryBytecode>(&bytecodes[i + 1]) : nullptr;
+
+            if (push && pop
+                && push->command == vmParse::MemoryCommand::PUSH
+                && pop->command == vmParse::MemoryCommand::POP
+                && pop->segment != vmParse::MemorySegment::CONSTANT) {
+                result.push_back(vmParse::MoveBytecode {push->segment, push->value, pop->segment, pop->value, push->line});
+                report[{push->segment, pop->segment}]++;
+                i++;
+                continue;
+            }
+
+            result.push_back(bytecodes[i]);
+        }
+
+        return result;
+    }
+
+    // Arithmetic as the Hack templates compute it: 16-bit wrapping, with gt
+    // and lt testing the sign of x-y just like the emitted D=M-D; D;JGT does.
+    std::optional<int16_t> fold(vmParse::LogicCommand command, int16_t x, int16_t y) {
+        auto difference = static_cast<int16_t>(x - y);
+        switch(command) {
+            case vmParse::LogicCommand::ADD: return static_cast<int16_t>(x + y);
+            case vmParse::LogicCommand::SUB: return difference;
+            case vmParse::LogicCommand::NEG: return static_cast<int16_t>(-y);
+            case vmParse::LogicCommand::EQ: return difference == 0 ? -1 : 0;
+            case vmParse::LogicCommand::GT: return difference > 0 ? -1 : 0;
+            case vmParse::LogicCommand::LT: return difference < 0 ? -1 : 0;
+            case vmParse::LogicCommand::AND: return static_cast<int16_t>(x & y);
+            case vmParse::LogicCommand::OR: return static_cast<int16_t>(x | y);
+            case vmParse::LogicCommand::NOT: return static_cast<int16_t>(~y);
+            default: return std::nullopt;
+        }
+    }
+
+    bool isUnary(vmParse::LogicCommand command) {
+        return command == vmParse::LogicCommand::NEG || command == vmParse::LogicCommand::NOT;
+    }
+
+    // x op y == x, so a known y can be dropped along with the command.
+    bool isIdentity(vmParse::LogicCommand command, int16_t y) {
+        switch(command) {
+            case vmParse::LogicCommand::ADD:
+            case vmParse::LogicCommand::SUB:
+            case vmParse::LogicCommand::OR:
+                return y == 0;
+            case vmParse::LogicCommand::AND:
+                return y == -1;
+            default:
+                return false;
+        }
+    }
+
+    // push constant only takes 0..32767; negative values go through not.
+    void pushConstant(std::vector<vmParse::Bytecode> &result, int16_t value) {
+        if (value >= 0) {
+            result.push_back(vmParse::MemoryBytecode {vmParse::MemoryCommand::PUSH, vmParse::MemorySegment::CONSTANT,
+                                                      static_cast<unsigned int>(value)});
+        } else {
+            result.push_back(vmParse::MemoryBytecode {vmParse::MemoryCommand::PUSH, vmParse::MemorySegment::CONSTANT,
+                                                      static_cast<unsigned int>(~value)});
+            result.push_back(vmParse::LogicBytecode {vmParse::LogicCommand::NOT});
+        }
+    }
+
+    /*
+    Constant folding
+
+    Constants pushed onto the stack are held back in `pending` rather than
+    emitted, so they always sit on top of everything emitted so far. Commands
+    whose operands are all pending are evaluated here; anything else first
+    emits the pending constants in order, leaving the stack as the original
+    program would have it.
+
+    Values popped into temp, static and absolute slots are remembered, and
+    later pushes of those slots become pending constants too. Nothing else
+    can write them, except a store through a base pointer that happens to
+    point there, so any pop into local, argument, this or that forgets
+    everything we know.
+    */
+    std::vector<vmParse::Bytecode> foldConstants(const std::vector<vmParse::Bytecode> &bytecodes, FoldReport &report) {
+        std::vector<vmParse::Bytecode> result;
+        std::vector<int16_t> pending;
+        std::map<std::pair<vmParse::MemorySegment, unsigned int>, int16_t> known;
+
+        auto materialize = [&]() {
+            for (auto value : pending) { pushConstant(result, value); }
+            pending.clear();
+        };
+
+        auto isTracked = [](vmParse::MemorySegment segment) {
+            return segment == vmParse::MemorySegment::TEMP || segment == vmParse::MemorySegment::STATIC
+                || segment == vmParse::MemorySegment::ABSOLUTE;
+        };
+
+        auto store = [&](vmParse::MemorySegment segment, unsigned int value, std::optional<int16_t> stored) {
+            if (isTracked(segment)) {
+                if (stored.has_value()) {
+                    known[{segment, value}] = stored.value();
+                } else {
+                    known.erase({segment, value});
+                }
+            } else if (segment != vmParse::MemorySegment::POINTER) {
+                known.clear();
+            }
+        };
+
+        for (const auto &bytecode : bytecodes) {
+            if (auto b = std::get_if<vmParse::LogicBytecode>(&bytecode)) {
+                auto arity = isUnary(b->command) ? 1u : 2u;
+                if (pending.size() >= arity) {
+                    int16_t y = pending.back();
+                    pending.pop_back();
+                    int16_t x = 0;
+                    if (arity == 2) {
+                        x = pending.back();
+                        pending.pop_back();
+                    }
+                    pending.push_back(fold(b->command, x, y).value());
+                    report.folded++;
+                } else if (pending.size() == 1 && isIdentity(b->command, pending.back())) {
+                    pending.pop_back();
+                    report.simplified++;
+                } else {
+                    materialize();
+                    result.push_back(bytecode);
+                }
+            } else if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode)) {
+                if (b->command == vmParse::MemoryCommand::PUSH) {
+                    if (b->segment == vmParse::MemorySegment::CONSTANT) {
+                        pending.push_back(static_cast<int16_t>(b->value));
+                    } else if (auto hit = known.find({b->segment, b->value}); hit != known.end()) {
+                        pending.push_back(hit->second);
+                        report.propagated++;
+                    } else {
+                        materialize();
+                        result.push_back(bytecode);
+                    }
+                } else {
+                    std::optional<int16_t> stored;
+                    if (!pending.empty()) {
+                        stored = pending.back();
+                        pending.pop_back();
+                        pushConstant(result, stored.value());
+                    } else {
+                        materialize();
+                    }
+                    result.push_back(bytecode);
+                    store(b->segment, b->value, stored);
+                }
+            } else if (auto b = std::get_if<vmParse::FlowBytecode>(&bytecode)) {
+                if (b->command == vmParse::FlowCommand::IF_GOTO && !pending.empty()) {
+                    // The condition is known, so the branch is either always
+                    // or never taken.
+                    auto condition = pending.back();
+                    pending.pop_back();
+                    materialize();
+                    if (condition != 0) {
+                        result.push_back(vmParse::FlowBytecode {vmParse::FlowCommand::GOTO, b->label, b->line});
+                    }
+                    report.folded++;
+                    continue;
+                }
+
+                materialize();
+                result.push_back(bytecode);
+                if (b->command == vmParse::FlowCommand::LABEL) {
+                    // Other paths join here with their own values.
+                    known.clear();
+                }
+            } else if (auto b = std::get_if<vmParse::CompareBranchBytecode>(&bytecode)) {
+                if (pending.size() >= 2) {
+                    int16_t y = pending.back();
+                    pending.pop_back();
+                    int16_t x = pending.back();
+                    pending.pop_back();
+                    materialize();
+                    if ((fold(b->command, x, y).value() != 0) != b->negated) {
+                        result.push_back(vmParse::FlowBytecode {vmParse::FlowCommand::GOTO, b->label, b->line});
+                    }
+                    report.folded++;
+                    continue;
+                }
+
+                materialize();
+                result.push_back(bytecode);
+            } else if (std::holds_alternative<vmParse::FunctionBytecode>(bytecode)) {
+                // A function is entered from any call site, and a callee may
+                // write temp and static behind our back.
+                materialize();
+                result.push_back(bytecode);
+                known.clear();
+            } else if (auto b = std::get_if<vmParse::MoveBytecode>(&bytecode)) {
+                std::optional<int16_t> stored;
+                if (b->fromSegment == vmParse::MemorySegment::CONSTANT) {
+                    stored = static_cast<int16_t>(b->fromValue);
+                } else if (auto hit = known.find({b->fromSegment, b->fromValue}); hit != known.end()) {
+                    stored = hit->second;
+                }
+                result.push_back(bytecode);
+                store(b->toSegment, b->toValue, stored);
+            } else if (std::holds_alternative<vmParse::CountBytecode>(bytecode)) {
+                // Counters are out of the program's sight and off the stack.
+                result.push_back(bytecode);
+            } else if (auto b = std::get_if<vmParse::ArrayBytecode>(&bytecode)) {
+                materialize();
+                result.push_back(bytecode);
+                // A store through a pointer could land on anything.
+                if (b->command == vmParse::MemoryCommand::POP) { known.clear(); }
+            }
+        }
+        materialize();
+
+        return result;
+    }
+
+    /*
+    Array access
+
+    Jack reads a[i] as push a; push i; add; pop pointer 1; push that 0. It
+    writes it the same way ending in pop that 0 when the value is already
+    underneath, or, as the standard compiler does, as push a; push i; add,
+    then the value, then pop temp 0; pop pointer 1; push temp 0; pop that 0.
+    Once folding has dropped a zero index there is no push i; add, and a
+    lone base may be read at an offset through that k. Each becomes one
+    ArrayBytecode.
+
+    The temp 0 form reads base and index after the value instead of before,
+    so the value must not be able to write them: calls are only allowed when
+    both are local, argument or constant slots, which a callee can't reach,
+    and the only pops allowed are into pointer 1, as reads nested in the
+    value do, when neither goes through THAT.
+
+    THAT is only set if something may read it before it is next written.
+    */
+    bool readsThat(vmParse::MemorySegment segment, unsigned int value) {
+        return segment == vmParse::MemorySegment::THAT || (segment == vmParse::MemorySegment::POINTER && value == 1);
+    }
+
+    bool isPointer1(vmParse::MemorySegment segment, unsigned int value) {
+        return segment == vmParse::MemorySegment::POINTER && value == 1;
+    }
+
+    // Whether the code from i on may read THAT before writing it. Flow and
+    // calls are taken to read it, and return restores the caller's.
+    bool thatLive(const std::vector<vmParse::Bytecode> &bytecodes, size_t i) {
+        for (; i < bytecodes.size(); i++) {
+            const auto &bytecode = bytecodes[i];
+            if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode)) {
+                if (isPointer1(b->segment, b->value)) { return b->command == vmParse::MemoryCommand::PUSH; }
+                if (b->segment == vmParse::MemorySegment::THAT) { return true; }
+            } else if (auto b = std::get_if<vmParse::MoveBytecode>(&bytecode)) {
+                if (readsThat(b->fromSegment, b->fromValue) || b->toSegment == vmParse::MemorySegment::THAT) { return true; }
+                if (isPointer1(b->toSegment, b->toValue)) { return false; }
+            } else if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode)) {
+                return b->command != vmParse::FunctionCommand::RETURN;
+            } else if (!std::holds_alternative<vmParse::LogicBytecode>(bytecode) && !std::holds_alternative<vmParse::CountBytecode>(bytecode)) {
+                return true;
+            }
+        }
+        return true;
+    }
+
+    // Where the value of a temp 0 store, starting at i, ends: the pop temp 0
+    // reached with exactly one value pushed, if everything before it can run
+    // ahead of reading the base and index of access.
+    std::optional<size_t> storedValueEnd(const std::vector<vmParse::Bytecode> &bytecodes, size_t i, size_t to,
+                                         const vmParse::ArrayBytecode &access) {
+        auto callSafe = [](vmParse::MemorySegment segment) {
+            return segment == vmParse::MemorySegment::LOCAL || segment == vmParse::MemorySegment::ARGUMENT
+                || segment == vmParse::MemorySegment::CONSTANT;
+        };
+        bool calls = callSafe(access.baseSegment) && callSafe(access.indexSegment);
+        bool pointerPops = !readsThat(access.baseSegment, access.baseValue) && !readsThat(access.indexSegment, access.indexValue);
+
+        unsigned int depth = 0;
+        for (; i < to; i++) {
+            const auto &bytecode = bytecodes[i];
+            unsigned int pops = 0;
+            unsigned int pushes = 0;
+            if (auto b = std::get_if<vmParse::LogicBytecode>(&bytecode)) {
+                pops = isUnary(b->command) ? 1 : 2;
+                pushes = 1;
+            } else if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode)) {
+                if (b->command == vmParse::MemoryCommand::PUSH) {
+                    pushes = 1;
+                } else if (depth == 1 && b->segment == vmParse::MemorySegment::TEMP && b->value == 0) {
+                    return i;
+                } else if (pointerPops && isPointer1(b->segment, b->value)) {
+                    pops = 1;
+                } else {
+                    return std::nullopt;
+                }
+            } else if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode); b && calls && b->command == vmParse::FunctionCommand::CALL) {
+                pops = b->value;
+                pushes = 1;
+            } else if (!std::holds_alternative<vmParse::CountBytecode>(bytecode)) {
+                return std::nullopt;
+            }
+
+            if (depth < pops) { return std::nullopt; }
+            depth = depth - pops + pushes;
+        }
+        return std::nullopt;
+    }
+
+    void fuseArrayAccess(const std::vector<vmParse::Bytecode> &bytecodes, size_t from, size_t to, std::vector<vmParse::Bytecode> &result,
+                         ArrayReport &report) {
+        auto memory = [&](size_t i) {
+            return i < to ? std::get_if<vmParse::MemoryBytecode>(&bytecodes[i]) : nullptr;
+        };
+        auto is = [&](size_t i, vmParse::MemoryCommand command, vmParse::MemorySegment segment, unsigned int value) {
+            auto b = memory(i);
+            return b && b->command == command && b->segment == segment && b->value == value;
+        };
+        auto add = [&](vmParse::ArrayBytecode access) {
+            (access.command == vmParse::MemoryCommand::PUSH ? report.loads : report.stores)++;
+            if (access.setsThat) { report.setThat++; }
+            result.push_back(access);
+        };
+
+        for (size_t i = from; i < to; i++) {
+            auto base = memory(i);
+            if (!base || base->command != vmParse::MemoryCommand::PUSH) {
+                result.push_back(bytecodes[i]);
+                continue;
+            }
+
+            vmParse::ArrayBytecode access {
+                vmParse::MemoryCommand::PUSH, base->segment, base->value, vmParse::MemorySegment::CONSTANT, 0, false, false, base->line
+            };
+            auto index = memory(i + 1);
+            auto sum = i + 2 < to ? std::get_if<vmParse::LogicBytecode>(&bytecodes[i + 2]) : nullptr;
+            bool indexed = index && index->command == vmParse::MemoryCommand::PUSH && sum && sum->command == vmParse::LogicCommand::ADD;
+            if (indexed) {
+                access.indexSegment = index->segment;
+                access.indexValue = index->value;
+            }
+            auto next = indexed ? i + 3 : i + 1;
+
+            // Through pointer 1 straight away. THAT can only be left holding
+            // the element's address, so an offset from a lone base is only
+            // folded in when nothing reads THAT afterwards.
+            auto element = memory(next + 1);
+            if (is(next, vmParse::MemoryCommand::POP, vmParse::MemorySegment::POINTER, 1)
+                && element && element->segment == vmParse::MemorySegment::THAT && (!indexed || element->value == 0)) {
+                access.command = element->command;
+                access.setsThat = thatLive(bytecodes, next + 2);
+                if (!indexed) { access.indexValue = element->value; }
+                if (!access.setsThat || access.indexValue == 0) {
+                    add(access);
+                    i = next + 1;
+                    continue;
+                }
+            }
+
+            // Through temp 0, after the value. The value goes into temp 0
+            // before base and index are read, so neither may be temp 0.
+            bool usesTemp = is(i, vmParse::MemoryCommand::PUSH, vmParse::MemorySegment::TEMP, 0)
+                || (indexed && is(i + 1, vmParse::MemoryCommand::PUSH, vmParse::MemorySegment::TEMP, 0));
+            auto end = usesTemp ? std::nullopt : storedValueEnd(bytecodes, next, to, access);
+            if (end && is(end.value() + 1, vmParse::MemoryCommand::POP, vmParse::MemorySegment::POINTER, 1)
+                && is(end.value() + 2, vmParse::MemoryCommand::PUSH, vmParse::MemorySegment::TEMP, 0)
+                && is(end.value() + 3, vmParse::MemoryCommand::POP, vmParse::MemorySegment::THAT, 0)) {
+                fuseArrayAccess(bytecodes, next, end.value(), result, report);
+                access.command = vmParse::MemoryCommand::POP;
+                access.setsTemp = true;
+                access.setsThat = thatLive(bytecodes, end.value() + 4);
+                access.line = vmParse::lineOf(bytecodes[end.value()]);
+                add(access);
+                i = end.value() + 3;
+                continue;
+            }
+
+            result.push_back(bytecodes[i]);
+        }
+    }
+
+    std::vector<vmParse::Bytecode> fuseArrayAccess(const std::vector<vmParse::Bytecode> &bytecodes, ArrayReport &report) {
+        std::vector<vmParse::Bytecode> result;
+        result.reserve(bytecodes.size());
+        fuseArrayAccess(bytecodes, 0, bytecodes.size(), result, report);
+        return result;
+    }
+
+    bool isComparison(vmParse::LogicCommand command) {
+        return command == vmParse::LogicCommand::EQ || command == vmParse::LogicCommand::GT || command == vmParse::LogicCommand::LT;
+    }
+
+    std::vector<vmParse::Bytecode> fuseCompareBranch(const std::vector<vmParse::Bytecode> &bytecodes, BranchReport &report) {
+        std::vector<vmParse::Bytecode> result;
+        result.reserve(bytecodes.size());
+
+        auto isLogic = [&](size_t i, auto predicate) {
+            if (i >= bytecodes.size()) { return false; }
+            auto b = std::get_if<vmParse::LogicBytecode>(&bytecodes[i]);
+            return b && predicate(b->command);
+        };
+
+        for (size_t i = 0; i < bytecodes.size(); i++) {
+            if (isLogic(i, isComparison)) {
+                const auto &compare = std::get<vmParse::LogicBytecode>(bytecodes[i]);
+                auto command = compare.command;
+                bool negated = isLogic(i + 1, [](vmParse::LogicCommand c) { return c == vmParse::LogicCommand::NOT; });
+                auto branchAt = i + (negated ? 2 : 1);
+                auto branch = branchAt < bytecodes.size() ? std::get_if<vmParse::FlowBytecode>(&bytecodes[branchAt]) : nullptr;
+
+                if (branch && branch->command == vmParse::FlowCommand::IF_GOTO) {
+                    result.push_back(vmParse::CompareBranchBytecode {command, negated, branch->label, compare.line});
+                    report[{command, negated}]++;
+                    i = branchAt;
+                    continue;
+                }
+            }
+
+            result.push_back(bytecodes[i]);
+        }
+
+        return result;
+    }
+
+    std::vector<vmParse::Bytecode> markTailCalls(const std::vector<vmParse::Bytecode> &bytecodes, TailCallReport &report) {
+        std::vector<vmParse::Bytecode> result;
+        // Code outside any function has no frame to reuse.
+        bool inFunction = false;
+
+        for (size_t i = 0; i < bytecodes.size(); i++) {
+            auto call = std::get_if<vmParse::FunctionBytecode>(&bytecodes[i]);
+            if (call && call->command == vmParse::FunctionCommand::FUNCTION) {
+                inFunction = true;
+            }
+
+            if (inFunction && call && call->command == vmParse::FunctionCommand::CALL && i + 1 < bytecodes.size()) {
+                auto ret = std::get_if<vmParse::FunctionBytecode>(&bytecodes[i + 1]);
+                if (ret && ret->command == vmParse::FunctionCommand::RETURN) {
+                    result.push_back(vmParse::FunctionBytecode {vmParse::FunctionCommand::TAIL_CALL, call->name, call->value, vmParse::DEFAULT, call->line});
+                    report[call->name]++;
+                    i++;
+                    continue;
+                }
+            }
+
+            result.push_back(bytecodes[i]);
+        }
+
+        return result;
+    }
+
+    void print(const FusionReport &report, std::ostream &out) {
+        unsigned int total = 0;
+        out << "Push/pop fusion" << std::endl << "==========" << std::endl;
+        for (const auto &[segments, count] : report) {
+            out << boost::format("%-8s -> %-8s %d")
+                % vmParse::segmentName(segments.first)
+                % vmParse::segmentName(segments.second)
+                % count
+                << std::endl;
+            total += count;
+        }
+        out << boost::format("%d pairs fused") % total << std::endl << std::endl;
+    }
+
+    void print(const FoldReport &report, std::ostream &out) {
+        out << "Constant folding" << std::endl << "==========" << std::endl;
+        out << boost::format("%d commands folded") % report.folded << std::endl;
+        out << boost::format("%d identities removed") % report.simplified << std::endl;
+        out << boost::format("%d loads replaced by constants") % report.propagated << std::endl << std::endl;
+    }
+
+    void print(const ArrayReport &report, std::ostream &out) {
+        out << "Array access" << std::endl << "==========" << std::endl;
+        out << boost::format("%d loads") % report.loads << std::endl;
+        out << boost::format("%d stores") % report.stores << std::endl;
+        out << boost::format("%d still set THAT") % report.setThat << std::endl << std::endl;
+    }
+
+    void print(const BranchReport &report, std::ostream &out) {
+        unsigned int total = 0;
+        out << "Compare-branch fusion" << std::endl << "==========" << std::endl;
+        for (const auto &[branch, count] : report) {
+            out << boost::format("%-8s %d")
+                % ((branch.second ? "not " : "") + vmParse::commandName(branch.first))
+                % count
+                << std::endl;
+            total += count;
+        }
+        out << boost::format("%d branches fused") % total << std::endl << std::endl;
+    }
+
+    void print(const TailCallReport &report, std::ostream &out) {
+        unsigned int total = 0;
+        out << "Tail calls" << std::endl << "==========" << std::endl;
+        for (const auto &[function, count] : report) {
+            out << boost::format("%-30s %d") % function % count << std::endl;
+            total += count;
+        }
+        out << boost::format("%d calls reuse their caller's frame") % total << std::endl << std::endl;
+    }
+}
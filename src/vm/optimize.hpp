@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "parse.hpp"
+
+namespace vmOptimize {
+    // Fusion counts keyed by (from segment, to segment).
+    using FusionReport = std::map<std::pair<vmParse::MemorySegment, vmParse::MemorySegment>, unsigned int>;
+
+    // Replace each push immediately followed by a pop with a MoveBytecode.
+    std::vector<vmParse::Bytecode> fusePushPop(const std::vector<vmParse::Bytecode> &bytecodes, FusionReport &report);
+
+    // x op y as the Hack code computes it; y alone for neg and not.
+    std::optional<int16_t> fold(vmParse::LogicCommand command, int16_t x, int16_t y);
+    // Push value, through not if it is negative.
+    void pushConstant(std::vector<vmParse::Bytecode> &result, int16_t value);
+
+    struct FoldReport {
+        unsigned int folded = 0;
+        unsigned int simplified = 0;
+        unsigned int propagated = 0;
+    };
+
+    // Fold arithmetic and logic over constants known at translation time,
+    // carrying constants through temp and static where nothing can alias them.
+    std::vector<vmParse::Bytecode> foldConstants(const std::vector<vmParse::Bytecode> &bytecodes, FoldReport &report);
+
+    struct ArrayReport {
+        unsigned int loads = 0;
+        unsigned int stores = 0;
+        // Accesses that still had to leave the address in THAT.
+        unsigned int setThat = 0;
+    };
+
+    // Replace Jack's array loads and stores through pointer 1 and that 0 with
+    // ArrayBytecodes.
+    std::vector<vmParse::Bytecode> fuseArrayAccess(const std::vector<vmParse::Bytecode> &bytecodes, ArrayReport &report);
+
+    // Fusion counts keyed by comparison, for plain and negated conditions.
+    using BranchReport = std::map<std::pair<vmParse::LogicCommand, bool>, unsigned int>;
+
+    // Replace eq/gt/lt, optionally followed by not, then if-goto with a
+    // CompareBranchBytecode.
+    std::vector<vmParse::Bytecode> fuseCompareBranch(const std::vector<vmParse::Bytecode> &bytecodes, BranchReport &report);
+
+    // Tail calls marked, keyed by callee.
+    using TailCallReport = std::map<std::string, unsigned int>;
+
+    // Replace each call immediately followed by return, inside a function,
+    // with a single TAIL_CALL.
+    std::vector<vmParse::Bytecode> markTailCalls(const std::vector<vmParse::Bytecode> &bytecodes, TailCallReport &report);
+
+    void print(const FusionReport &report, std::ostream &out = std::cout);
+    void print(const FoldReport &report, std::ostream &out = std::cout);
+    void print(const ArrayReport &report, std::ostream &out = std::cout);
+    void print(const BranchReport &report, std::ostream &out = std::cout);
+    void print(const TailCallReport &report, std::ostream &out = std::cout);
+}
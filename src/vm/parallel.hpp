@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace vmParallel {
+    // Workers to use for jobs, where 0 means one per hardware thread.
+    inline unsigned int workers(unsigned int jobs) {
+        return jobs > 0 ? jobs : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Run work(i) for every i below count on at most jobs workers. Indices
+    // are handed out in order and callers store results by index, so the
+    // output never depends on which worker finishes first.
+    template <typename Work>
+    void parallelFor(size_t count, unsigned int jobs, Work work) {
+        std::atomic<size_t> next = 0;
+        auto worker = [&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                work(i);
+            }
+        };
+
+        auto running = std::min<size_t>(count, workers(jobs));
+        std::vector<std::future<void>> futures;
+        for (size_t i = 0; i < running; i++) {
+            futures.push_back(std::async(std::launch::async, worker));
+        }
+        for (auto &f : futures) {
+            f.get();
+        }
+    }
+}
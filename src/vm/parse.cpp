@@ -1,15 +1,17 @@
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <optional>
+#include <string_view>
 #include <variant>
 #include <vector>
 
-#include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 
 #include "overloaded.hpp"
+#include "parse.hpp"
 
 /* 
 Grammar
@@ -39,11 +41,19 @@ constant
 static
 temp
 pointer
+
+Program flow commands
+label symbol
+goto symbol
+if-goto symbol
+
+Function calling commands
+function functionName nLocals
+call functionName nArgs
+return
 */
 
 namespace vmParse {
-    enum LogicCommand { ADD, SUB, NEG, EQ, GT, LT, AND, OR, NOT };
-
     std::map<std::string, LogicCommand> logicCommandLookup {
         {"add", LogicCommand::ADD},
         {"sub", LogicCommand::SUB},
@@ -56,13 +66,6 @@ namespace vmParse {
         {"not", LogicCommand::NOT},
     };
 
-    enum MemoryCommand { PUSH, POP };
-    std::map<std::string, MemoryCommand> memoryCommandLookup {
-        {"push", MemoryCommand::PUSH},
-        {"pop", MemoryCommand::POP},
-    };
-
-    enum MemorySegment { LOCAL, ARGUMENT, THIS, THAT, CONSTANT, STATIC, TEMP, POINTER };
     std::map<std::string, MemorySegment> memorySegmentLookup {
         {"local", MemorySegment::LOCAL},
         {"argument", MemorySegment::ARGUMENT},
@@ -72,20 +75,31 @@ namespace vmParse {
         {"static", MemorySegment::STATIC},
         {"temp", MemorySegment::TEMP},
         {"pointer", MemorySegment::POINTER},  
+        {"absolute", MemorySegment::ABSOLUTE},
     };
 
-    struct LogicBytecode {
-        LogicCommand command;
-    };
+    std::string commandName(LogicCommand command) {
+        for (const auto &[name, value] : logicCommandLookup) {
+            if (value == command) { return name; }
+        }
+        throw std::out_of_range("Unreachable condition");
+    }
 
-    struct MemoryBytecode {
-        MemoryCommand command;
-        MemorySegment segment;
-        unsigned int value;
-    };
+    std::string segmentName(MemorySegment segment) {
+        for (const auto &[name, value] : memorySegmentLookup) {
+            if (value == segment) { return name; }
+        }
+        throw std::out_of_range("Unreachable condition");
+    }
+
+    unsigned int lineOf(const Bytecode &bytecode) {
+        return std::visit([](const auto &b) { return b.line; }, bytecode);
+    }
+
+    void setLine(Bytecode &bytecode, unsigned int line) {
+        std::visit([line](auto &b) { b.line = line; }, bytecode);
+    }
 
-    using Bytecode = std::variant<LogicBytecode, MemoryBytecode>;    
-        
     void print(Bytecode bytecode) {
         return std::visit(overloaded {
             [](LogicBytecode l) { std::cout << boost::format("LogicBytecode {command %s}") % l.command << std::endl; },
@@ -94,36 +108,157 @@ namespace vmParse {
             % m.segment
             % m.value
             << std::endl; },
+            [](MoveBytecode m) { std::cout << boost::format("MoveBytecode {from %s %d to %s %d}")
+            % segmentName(m.fromSegment)
+            % m.fromValue
+            % segmentName(m.toSegment)
+            % m.toValue
+            << std::endl; },
+            [](FlowBytecode f) { std::cout << boost::format("FlowBytecode {command %s label %s}") % f.command % f.label << std::endl; },
+            [](FunctionBytecode f) { std::cout << boost::format("FunctionBytecode {command %s name %s value %d}")
+            % f.command
+            % f.name
+            % f.value
+            << std::endl; },
+            [](CompareBranchBytecode c) { std::cout << boost::format("CompareBranchBytecode {command %s negated %d label %s}")
+            % c.command
+            % c.negated
+            % c.label
+            << std::endl; },
+            [](CountBytecode c) { std::cout << boost::format("CountBytecode {address %d}") % c.address << std::endl; },
+            [](ArrayBytecode a) { std::cout << boost::format("ArrayBytecode {command %s base %s %d index %s %d that %d temp %d}")
+            % a.command
+            % segmentName(a.baseSegment)
+            % a.baseValue
+            % segmentName(a.indexSegment)
+            % a.indexValue
+            % a.setsThat
+            % a.setsTemp
+            << std::endl; },
             }, bytecode);
     };
 
-    std::optional<Bytecode> parseLine(std::string line) {
-        // Get rid of comments, then strip whitespace from ends
-        auto from_comment_char = line.find("//");
-        if (from_comment_char != std::string::npos) {
-            line.erase(from_comment_char);
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    // Split the next whitespace-separated word off the front of rest. Returns
+    // an empty view once the line is used up.
+    std::string_view nextWord(std::string_view &rest) {
+        size_t start = 0;
+        while (start < rest.size() && isSpace(rest[start])) { start++; }
+        size_t end = start;
+        while (end < rest.size() && !isSpace(rest[end])) { end++; }
+        auto word = rest.substr(start, end - start);
+        rest.remove_prefix(end);
+        return word;
+    }
+
+    unsigned int parseIndex(std::string_view word, std::string_view line) {
+        if (word.empty()) {
+            throw std::out_of_range("Missing index: " + std::string(line));
+        }
+        unsigned int value = 0;
+        for (char c : word) {
+            if (c < '0' || c > '9') {
+                throw std::out_of_range("Invalid index: " + std::string(word));
+            }
+            value = value * 10 + (c - '0');
         }
-        boost::trim(line);
+        return value;
+    }
 
-        if (line.length() == 0) { return std::nullopt; }
+    MemorySegment parseSegment(std::string_view word) {
+        if (!word.empty()) {
+            switch(word[0]) {
+                case 'l': if (word == "local") { return MemorySegment::LOCAL; } break;
+                case 'a': if (word == "argument") { return MemorySegment::ARGUMENT; } break;
+                case 't':
+                    if (word == "this") { return MemorySegment::THIS; }
+                    if (word == "that") { return MemorySegment::THAT; }
+                    if (word == "temp") { return MemorySegment::TEMP; }
+                    break;
+                case 'c': if (word == "constant") { return MemorySegment::CONSTANT; } break;
+                case 's': if (word == "static") { return MemorySegment::STATIC; } break;
+                case 'p': if (word == "pointer") { return MemorySegment::POINTER; } break;
+            }
+        }
+        throw std::out_of_range("Unknown memory segment: " + std::string(word));
+    }
 
-        std::vector<std::string> words;
-        boost::split(words, line, [](char c){return c == ' ';});
+    std::string parseSymbol(std::string_view &rest, std::string_view line) {
+        auto label = nextWord(rest);
+        if (label.empty()) {
+            throw std::out_of_range("Missing symbol: " + std::string(line));
+        }
+        return std::string(label);
+    }
 
-        if (auto v = logicCommandLookup.find(words[0]); v != logicCommandLookup.end()) {
-            return LogicBytecode {v->second};
+    std::optional<Bytecode> parseLine(std::string_view line) {
+        // Get rid of comments; whitespace is skipped by nextWord
+        if (auto from_comment_char = line.find("//"); from_comment_char != std::string_view::npos) {
+            line = line.substr(0, from_comment_char);
         }
 
-        if (auto v = memoryCommandLookup.find(words[0]); v != memoryCommandLookup.end()) {
-            auto segment = memorySegmentLookup.find(words[1]);
-            if (segment == memorySegmentLookup.end()) {
-                throw std::out_of_range("Unknown memory segment: " + words[1]);
-            }
+        std::string_view rest = line;
+        auto command = nextWord(rest);
+        if (command.empty()) { return std::nullopt; }
 
-            return MemoryBytecode{v->second, segment->second, static_cast<unsigned int>(stoul(words[2]))};
+        // Dispatch on the first letter, then confirm the whole mnemonic.
+        switch(command[0]) {
+            case 'a':
+                if (command == "add") { return LogicBytecode {LogicCommand::ADD}; }
+                if (command == "and") { return LogicBytecode {LogicCommand::AND}; }
+                break;
+            case 's':
+                if (command == "sub") { return LogicBytecode {LogicCommand::SUB}; }
+                break;
+            case 'n':
+                if (command == "neg") { return LogicBytecode {LogicCommand::NEG}; }
+                if (command == "not") { return LogicBytecode {LogicCommand::NOT}; }
+                break;
+            case 'e':
+                if (command == "eq") { return LogicBytecode {LogicCommand::EQ}; }
+                break;
+            case 'g':
+                if (command == "gt") { return LogicBytecode {LogicCommand::GT}; }
+                if (command == "goto") { return FlowBytecode {FlowCommand::GOTO, parseSymbol(rest, line)}; }
+                break;
+            case 'l':
+                if (command == "lt") { return LogicBytecode {LogicCommand::LT}; }
+                if (command == "label") { return FlowBytecode {FlowCommand::LABEL, parseSymbol(rest, line)}; }
+                break;
+            case 'o':
+                if (command == "or") { return LogicBytecode {LogicCommand::OR}; }
+                break;
+            case 'i':
+                if (command == "if-goto") { return FlowBytecode {FlowCommand::IF_GOTO, parseSymbol(rest, line)}; }
+                break;
+            case 'f':
+                if (command == "function") {
+                    auto name = parseSymbol(rest, line);
+                    return FunctionBytecode {FunctionCommand::FUNCTION, name, parseIndex(nextWord(rest), line)};
+                }
+                break;
+            case 'c':
+                if (command == "call") {
+                    auto name = parseSymbol(rest, line);
+                    return FunctionBytecode {FunctionCommand::CALL, name, parseIndex(nextWord(rest), line)};
+                }
+                break;
+            case 'r':
+                if (command == "return") { return FunctionBytecode {FunctionCommand::RETURN, "", 0}; }
+                break;
+            case 'p':
+                if (command == "push" || command == "pop") {
+                    auto segment = parseSegment(nextWord(rest));
+                    auto index = parseIndex(nextWord(rest), line);
+                    return MemoryBytecode {command == "push" ? MemoryCommand::PUSH : MemoryCommand::POP, segment, index};
+                }
+                break;
         }
 
-        throw std::out_of_range("Could not parse line: " + line);
+        throw std::out_of_range("Could not parse line: " + std::string(line));
     }
 
     std::vector<Bytecode> parseFile(std::string input_filepath) {
@@ -135,9 +270,12 @@ namespace vmParse {
         }
 
         std::string line;
+        unsigned int number = 0;
         while (std::getline(input_file, line)) {
+            number++;
             auto parsed_line = parseLine(line);
             if (parsed_line.has_value()) {
+                setLine(parsed_line.value(), number);
                 parsed.push_back(parsed_line.value());
             }
         }    
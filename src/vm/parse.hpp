@@ -1,3 +1,8 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -6,19 +11,103 @@ namespace vmParse {
 
     enum MemoryCommand { PUSH, POP };
 
-    enum MemorySegment { LOCAL, ARGUMENT, THIS, THAT, CONSTANT, STATIC, TEMP, POINTER };
+    // ABSOLUTE is produced by the optimizer: value is a RAM address.
+    enum MemorySegment { LOCAL, ARGUMENT, THIS, THAT, CONSTANT, STATIC, TEMP, POINTER, ABSOLUTE };
+
+    enum FlowCommand { LABEL, GOTO, IF_GOTO };
+
+    // TAIL_CALL is produced by the optimizer: a call whose result is
+    // returned straight away.
+    enum FunctionCommand { FUNCTION, CALL, RETURN, TAIL_CALL };
 
+    // How a command that has a shared routine is translated: eq, gt and lt
+    // for the plain translator, call and return for both. DEFAULT leaves it
+    // to the options; the ROM budget picks INLINE or SHARED per site.
+    enum Placement { DEFAULT, INLINE, SHARED };
+
+    // Every command carries the .vm line it was parsed from, or 0 for code
+    // the optimizer made up with no line of its own.
     struct LogicBytecode {
         LogicCommand command;
+        Placement placement = DEFAULT;
+        unsigned int line = 0;
     };
 
     struct MemoryBytecode {
         MemoryCommand command;
         MemorySegment segment;
         unsigned int value;
+        unsigned int line = 0;
     };    
 
-    using Bytecode = std::variant<LogicBytecode, MemoryBytecode>;        
+    // Produced by the optimizer, never by the parser: copy one segment slot
+    // to another without going through the stack.
+    struct MoveBytecode {
+        MemorySegment fromSegment;
+        unsigned int fromValue;
+        MemorySegment toSegment;
+        unsigned int toValue;
+        unsigned int line = 0;
+    };
+
+    struct FlowBytecode {
+        FlowCommand command;
+        std::string label;
+        unsigned int line = 0;
+    };
+
+    // value is the number of locals for function, arguments for call, and
+    // unused for return.
+    struct FunctionBytecode {
+        FunctionCommand command;
+        std::string name;
+        unsigned int value;
+        Placement placement = DEFAULT;
+        unsigned int line = 0;
+    };
+
+    // Produced by the optimizer: eq, gt or lt (or its negation) consumed
+    // directly by an if-goto, so the boolean never reaches the stack.
+    struct CompareBranchBytecode {
+        LogicCommand command;
+        bool negated;
+        std::string label;
+        unsigned int line = 0;
+    };
+
+    // Produced by instrumentation: add one to the word at address, leaving
+    // the stack alone.
+    struct CountBytecode {
+        unsigned int address;
+        unsigned int line = 0;
+    };
+
+    // Produced by the optimizer: an array element base[index], with base and
+    // index both segment slots. push loads the element, pop stores the top of
+    // the stack into it. setsThat leaves THAT holding the element's address,
+    // as the pop pointer 1 this replaces did, for code that may still read
+    // it; setsTemp leaves the stored value in temp 0 in the same way.
+    struct ArrayBytecode {
+        MemoryCommand command;
+        MemorySegment baseSegment;
+        unsigned int baseValue;
+        MemorySegment indexSegment;
+        unsigned int indexValue;
+        bool setsThat;
+        bool setsTemp;
+        unsigned int line = 0;
+    };
+
+    using Bytecode = std::variant<LogicBytecode, MemoryBytecode, MoveBytecode, FlowBytecode, FunctionBytecode, CompareBranchBytecode,
+                                  CountBytecode, ArrayBytecode>;
+
+    std::string commandName(LogicCommand command);
+    std::string segmentName(MemorySegment segment);
+
+    unsigned int lineOf(const Bytecode &bytecode);
+    void setLine(Bytecode &bytecode, unsigned int line);
 
+    // One line of VM code, or nothing for blank and comment-only lines.
+    std::optional<Bytecode> parseLine(std::string_view line);
     std::vector<Bytecode> parseFile(std::string input_filepath);
 }
\ No newline at end of file
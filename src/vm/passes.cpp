@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "optimize.hpp"
+#include "parallel.hpp"
+#include "parse.hpp"
+#include "passes.hpp"
+#include "program.hpp"
+#include "ssa.hpp"
+#include "vm.hpp"
+
+namespace vmPasses {
+    template <typename Key>
+    void add(std::map<Key, unsigned int> &into, const std::map<Key, unsigned int> &from) {
+        for (const auto &[key, count] : from) { into[key] += count; }
+    }
+
+    void add(Reports &into, const Reports &from) {
+        into.ssa.reused += from.ssa.reused;
+        into.ssa.redundantStores += from.ssa.redundantStores;
+        into.ssa.deadStores += from.ssa.deadStores;
+        into.ssa.before += from.ssa.before;
+        into.ssa.after += from.ssa.after;
+        into.fold.folded += from.fold.folded;
+        into.fold.simplified += from.fold.simplified;
+        into.fold.propagated += from.fold.propagated;
+        into.arrays.loads += from.arrays.loads;
+        into.arrays.stores += from.arrays.stores;
+        into.arrays.setThat += from.arrays.setThat;
+        add(into.fusion, from.fusion);
+        add(into.branch, from.branch);
+        add(into.tailCalls, from.tailCalls);
+    }
+
+    void print(const Reports &reports, const vm::Options &options, std::ostream &out) {
+        if (options.ssa) { vmSsa::print(reports.ssa, out); }
+        if (options.foldConstants) { vmOptimize::print(reports.fold, out); }
+        if (options.fuseArrays) { vmOptimize::print(reports.arrays, out); }
+        if (options.fuseMoves) { vmOptimize::print(reports.fusion, out); }
+        if (options.fuseBranches) { vmOptimize::print(reports.branch, out); }
+        if (options.tailCalls) { vmOptimize::print(reports.tailCalls, out); }
+    }
+
+    const std::vector<Pass> &pipeline() {
+        static const std::vector<Pass> passes = {
+            {"ssa", &vm::Options::ssa,
+             [](const std::vector<vmParse::Bytecode> &b, Reports &r) { return vmSsa::optimize(b, r.ssa); }},
+            {"fold-constants", &vm::Options::foldConstants,
+             [](const std::vector<vmParse::Bytecode> &b, Reports &r) { return vmOptimize::foldConstants(b, r.fold); }},
+            {"fuse-arrays", &vm::Options::fuseArrays,
+             [](const std::vector<vmParse::Bytecode> &b, Reports &r) { return vmOptimize::fuseArrayAccess(b, r.arrays); }},
+            {"fuse-moves", &vm::Options::fuseMoves,
+             [](const std::vector<vmParse::Bytecode> &b, Reports &r) { return vmOptimize::fusePushPop(b, r.fusion); }},
+            {"fuse-branches", &vm::Options::fuseBranches,
+             [](const std::vector<vmParse::Bytecode> &b, Reports &r) { return vmOptimize::fuseCompareBranch(b, r.branch); }},
+            {"tail-calls", &vm::Options::tailCalls,
+             [](const std::vector<vmParse::Bytecode> &b, Reports &r) { return vmOptimize::markTailCalls(b, r.tailCalls); }},
+        };
+        return passes;
+    }
+
+    void enable(vm::Options &options, const std::string &name, bool enabled) {
+        for (const auto &pass : pipeline()) {
+            if (pass.name == name) {
+                options.*pass.enabled = enabled;
+                return;
+            }
+        }
+        throw std::invalid_argument("Unknown pass " + name);
+    }
+
+    void add(Stats &into, const Stats &from) {
+        for (size_t i = 0; i < into.passes.size(); i++) {
+            into.passes[i].functions += from.passes[i].functions;
+            into.passes[i].removed += from.passes[i].removed;
+            into.passes[i].time += from.passes[i].time;
+        }
+    }
+
+    std::vector<vmParse::Bytecode> run(std::vector<vmParse::Bytecode> bytecode, const vm::Options &options, Reports &reports, Stats &stats) {
+        const auto &passes = pipeline();
+        for (size_t i = 0; i < passes.size(); i++) {
+            if (!(options.*passes[i].enabled)) { continue; }
+
+            auto start = std::chrono::steady_clock::now();
+            auto result = passes[i].run(bytecode, reports);
+            auto &pass = stats.passes[i];
+            pass.time += std::chrono::steady_clock::now() - start;
+            if (result.size() != bytecode.size()) {
+                pass.functions++;
+                pass.removed += static_cast<int>(bytecode.size()) - static_cast<int>(result.size());
+            }
+            bytecode = std::move(result);
+        }
+        return bytecode;
+    }
+
+    std::vector<std::vector<vmParse::Bytecode>> splitFunctions(const std::vector<vmParse::Bytecode> &bytecode) {
+        std::vector<std::vector<vmParse::Bytecode>> functions;
+        for (const auto &b : bytecode) {
+            auto function = std::get_if<vmParse::FunctionBytecode>(&b);
+            if (functions.empty() || (function && function->command == vmParse::FunctionCommand::FUNCTION)) {
+                functions.emplace_back();
+            }
+            functions.back().push_back(b);
+        }
+        return functions;
+    }
+
+    vmProgram::Program run(const vmProgram::Program &program, const vm::Options &options, std::vector<Reports> &reports, Stats &stats) {
+        auto start = std::chrono::steady_clock::now();
+
+        // Every function of every unit, with the unit it came from.
+        std::vector<std::pair<size_t, std::vector<vmParse::Bytecode>>> pieces;
+        for (size_t i = 0; i < program.size(); i++) {
+            for (auto &function : splitFunctions(program[i].bytecode)) {
+                pieces.emplace_back(i, std::move(function));
+            }
+        }
+
+        std::vector<Reports> pieceReports(pieces.size());
+        std::vector<Stats> pieceStats(pieces.size());
+        vmParallel::parallelFor(pieces.size(), options.jobs, [&](size_t i) {
+            pieces[i].second = run(std::move(pieces[i].second), options, pieceReports[i], pieceStats[i]);
+        });
+
+        vmProgram::Program result;
+        reports.assign(program.size(), {});
+        for (const auto &unit : program) {
+            result.push_back({unit.name, {}});
+        }
+        for (size_t i = 0; i < pieces.size(); i++) {
+            auto &[unit, bytecode] = pieces[i];
+            result[unit].bytecode.insert(result[unit].bytecode.end(), bytecode.begin(), bytecode.end());
+            add(reports[unit], pieceReports[i]);
+            add(stats, pieceStats[i]);
+        }
+
+        stats.wall += std::chrono::steady_clock::now() - start;
+        stats.workers = std::min<size_t>(pieces.size(), vmParallel::workers(options.jobs));
+        return result;
+    }
+
+    void print(const Stats &stats, const vm::Options &options, std::ostream &out) {
+        out << "Passes" << std::endl << "==========" << std::endl;
+        out << boost::format("%-16s %10s %8s %10s") % "pass" % "functions" % "removed" % "ms" << std::endl;
+        const auto &passes = pipeline();
+        for (size_t i = 0; i < passes.size(); i++) {
+            if (!(options.*passes[i].enabled)) { continue; }
+            const auto &pass = stats.passes[i];
+            out << boost::format("%-16s %10d %8d %10.3f") % passes[i].name % pass.functions % pass.removed % (pass.time.count() / 1e6)
+                << std::endl;
+        }
+        if (stats.workers > 0) {
+            out << boost::format("%.3f ms on %d workers") % (stats.wall.count() / 1e6) % stats.workers << std::endl;
+        }
+        out << std::endl;
+    }
+}
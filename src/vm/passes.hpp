@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "optimize.hpp"
+#include "parse.hpp"
+#include "program.hpp"
+#include "ssa.hpp"
+#include "vm.hpp"
+
+namespace vmPasses {
+    // Reports of the per-function passes. Passes add to them, so one set can
+    // collect a whole file translated in pieces.
+    struct Reports {
+        vmSsa::SsaReport ssa;
+        vmOptimize::FoldReport fold;
+        vmOptimize::ArrayReport arrays;
+        vmOptimize::FusionReport fusion;
+        vmOptimize::BranchReport branch;
+        vmOptimize::TailCallReport tailCalls;
+    };
+
+    void add(Reports &into, const Reports &from);
+    void print(const Reports &reports, const vm::Options &options, std::ostream &out = std::cout);
+
+    // A pass that only looks at one function at a time, and the option that
+    // turns it on.
+    struct Pass {
+        std::string name;
+        bool vm::Options::*enabled;
+        std::vector<vmParse::Bytecode> (*run)(const std::vector<vmParse::Bytecode> &, Reports &);
+    };
+
+    // Every per-function pass, in the order they run.
+    const std::vector<Pass> &pipeline();
+
+    // Turn the pass called name on or off.
+    void enable(vm::Options &options, const std::string &name, bool enabled);
+
+    struct PassStats {
+        // Functions the pass changed the length of, and the commands it
+        // removed from them in all.
+        unsigned int functions = 0;
+        int removed = 0;
+        // Summed over workers, so it can exceed the time the passes took.
+        std::chrono::nanoseconds time {0};
+    };
+
+    // Per pass, in pipeline order.
+    struct Stats {
+        std::vector<PassStats> passes = std::vector<PassStats>(pipeline().size());
+        std::chrono::nanoseconds wall {0};
+        unsigned int workers = 0;
+    };
+
+    void add(Stats &into, const Stats &from);
+
+    // Each function with its function command first. Commands ahead of the
+    // first function are a piece of their own.
+    std::vector<std::vector<vmParse::Bytecode>> splitFunctions(const std::vector<vmParse::Bytecode> &bytecode);
+
+    // Run the enabled passes over bytecode holding at most one function.
+    std::vector<vmParse::Bytecode> run(std::vector<vmParse::Bytecode> bytecode, const vm::Options &options, Reports &reports, Stats &stats);
+
+    // Split every unit at its function commands and run the enabled passes
+    // over the pieces on options.jobs workers. Pieces are put back and
+    // their reports added up in order, so the result doesn't depend on how
+    // many workers there are. reports gets one set per unit.
+    vmProgram::Program run(const vmProgram::Program &program, const vm::Options &options, std::vector<Reports> &reports, Stats &stats);
+
+    void print(const Stats &stats, const vm::Options &options, std::ostream &out = std::cout);
+}
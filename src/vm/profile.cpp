@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "budget.hpp"
+#include "parse.hpp"
+#include "passes.hpp"
+#include "profile.hpp"
+#include "program.hpp"
+#include "sourcemap.hpp"
+
+/*
+Profile-guided layout
+
+A function is cut into blocks at labels and after jumps. Blocks the profile
+says never ran move, in order, behind the ones that did; the first block
+stays first. A block that fell into the next one and no longer does gets a
+jump there, labelling the next block if it had no label. Those jumps only
+run on the way into or out of a cold block. Jumps that now land on the very
+next command are dropped, which is where hot code gains: an if whose else
+never ran, say, no longer jumps over it.
+
+Functions that run off their end are left alone.
+*/
+
+namespace vmProfile {
+    Profile read(const std::string &path) {
+        std::ifstream input {path};
+        if (!input.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+
+        Profile profile;
+        std::string line;
+        unsigned int number = 0;
+        while (std::getline(input, line)) {
+            number++;
+            std::istringstream fields {line};
+            std::string kind;
+            if (!(fields >> kind) || kind[0] == '#') { continue; }
+
+            unsigned long count;
+            std::string function;
+            bool valid = static_cast<bool>(fields >> count >> function);
+            if (valid && kind == "call") {
+                profile.calls[function] += count;
+            } else if (std::string label; valid && kind == "loop" && fields >> label) {
+                profile.loops[{function, label}] += count;
+            } else if (unsigned int source; valid && kind == "line" && fields >> source) {
+                profile.lines[{function, source}] += count;
+                profile.counted.insert(function);
+            } else {
+                throw std::invalid_argument("Bad profile line " + std::to_string(number) + " in " + path);
+            }
+        }
+        return profile;
+    }
+
+    void write(const Profile &profile, const std::string &path) {
+        std::ofstream output_file(path, std::ofstream::out | std::ofstream::trunc);
+        if (!output_file.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+        for (const auto &[function, count] : profile.calls) {
+            output_file << "call " << count << ' ' << function << '\n';
+        }
+        for (const auto &[loop, count] : profile.loops) {
+            output_file << "loop " << count << ' ' << loop.first << ' ' << loop.second << '\n';
+        }
+        for (const auto &[line, count] : profile.lines) {
+            output_file << "line " << count << ' ' << line.first << ' ' << line.second << '\n';
+        }
+    }
+
+    std::map<uint32_t, unsigned long> readRuns(const std::string &path) {
+        std::ifstream input {path};
+        if (!input.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+        std::map<uint32_t, unsigned long> runs;
+        uint32_t next = 0;
+        std::string line;
+        unsigned int number = 0;
+        while (std::getline(input, line)) {
+            number++;
+            std::replace(line.begin(), line.end(), ':', ' ');
+            std::istringstream fields {line};
+            if ((fields >> std::ws).eof() || fields.peek() == '#') { continue; }
+            unsigned long first, second;
+            if (!(fields >> first)) {
+                throw std::invalid_argument("Bad count line " + std::to_string(number) + " in " + path);
+            }
+            if (fields >> second) {
+                next = first;
+                first = second;
+            }
+            runs[next++] += first;
+        }
+        return runs;
+    }
+
+    Profile lineCounts(const sourceMap::View &map, const std::map<uint32_t, unsigned long> &runs) {
+        Profile profile;
+        for (size_t i = 0; i < map.size(); i++) {
+            auto location = map[i];
+            if (location.file.empty() || location.line == 0 || location.function.empty()) { continue; }
+            auto hit = runs.find(map.start(i));
+            auto &count = profile.lines[{location.function, location.line}];
+            count = std::max(count, hit == runs.end() ? 0 : hit->second);
+            profile.counted.insert(location.function);
+        }
+        return profile;
+    }
+
+    template <typename Key>
+    unsigned long lookup(const std::map<Key, unsigned long> &counts, const Key &key) {
+        auto hit = counts.find(key);
+        return hit == counts.end() ? 0 : hit->second;
+    }
+
+    const vmParse::FlowBytecode *flow(const vmParse::Bytecode &bytecode, vmParse::FlowCommand command) {
+        auto b = std::get_if<vmParse::FlowBytecode>(&bytecode);
+        return b && b->command == command ? b : nullptr;
+    }
+
+    // own says which commands the profile counted themselves, rather than
+    // taking the count of a neighbour.
+    std::vector<double> counts(const std::vector<vmParse::Bytecode> &bytecode, const Profile &profile, std::vector<bool> &own) {
+        // Loop counts added where each loop starts and taken away past its end.
+        std::vector<double> change(bytecode.size() + 1);
+        for (const auto &loop : vmBudget::findLoops(bytecode)) {
+            double jumps = lookup(profile.loops, {loop.function, loop.label});
+            change[loop.start] += jumps;
+            change[loop.end + 1] -= jumps;
+        }
+
+        std::vector<double> result;
+        // Labels have no code, so no line counts: they take the count of
+        // the command after them.
+        std::vector<bool> ahead(bytecode.size());
+        own.assign(bytecode.size(), false);
+        std::string function;
+        // Code outside any function runs once, at startup.
+        double calls = 1;
+        double loops = 0;
+        for (size_t i = 0; i < bytecode.size(); i++) {
+            if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode[i]); b && b->command == vmParse::FunctionCommand::FUNCTION) {
+                function = b->name;
+                calls = lookup(profile.calls, function);
+            }
+            loops += change[i];
+
+            auto line = vmParse::lineOf(bytecode[i]);
+            if (!profile.counted.count(function)) {
+                own[i] = true;
+                result.push_back(calls + loops);
+            } else if (flow(bytecode[i], vmParse::FlowCommand::LABEL)) {
+                ahead[i] = true;
+                result.push_back(0);
+            } else if (auto hit = profile.lines.find({function, line}); hit != profile.lines.end()) {
+                own[i] = true;
+                result.push_back(hit->second);
+            } else {
+                result.push_back(result.empty() ? 0 : result.back());
+            }
+        }
+        for (size_t i = bytecode.size(); i-- > 0;) {
+            if (ahead[i] && i + 1 < bytecode.size()) { result[i] = result[i + 1]; }
+        }
+        return result;
+    }
+
+    vmBudget::Hotness hotness(const vmProgram::Program &program, const Profile &profile) {
+        vmBudget::Hotness result;
+        for (const auto &unit : program) {
+            std::vector<bool> own;
+            result.push_back(counts(unit.bytecode, profile, own));
+        }
+        return result;
+    }
+
+    bool fallsThrough(const vmParse::Bytecode &bytecode) {
+        if (auto b = std::get_if<vmParse::FlowBytecode>(&bytecode)) { return b->command != vmParse::FlowCommand::GOTO; }
+        if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode)) {
+            return b->command != vmParse::FunctionCommand::RETURN && b->command != vmParse::FunctionCommand::TAIL_CALL;
+        }
+        return true;
+    }
+
+    bool endsBlock(const vmParse::Bytecode &bytecode) {
+        if (auto b = std::get_if<vmParse::FlowBytecode>(&bytecode)) { return b->command != vmParse::FlowCommand::LABEL; }
+        return !fallsThrough(bytecode) || std::holds_alternative<vmParse::CompareBranchBytecode>(bytecode);
+    }
+
+    struct Block {
+        std::vector<vmParse::Bytecode> code;
+        // The most any of its commands ran, and the runs of its first and
+        // last commands.
+        double count = 0;
+        double first = 0;
+        double last = 0;
+        // Whether the profile counted any of its commands. A block whose
+        // code the passes folded away entirely has no count of its own, and
+        // isn't known to be cold.
+        bool counted = false;
+
+        bool cold() const { return counted && count == 0; }
+    };
+
+    std::vector<vmParse::Bytecode> layoutFunction(const std::vector<vmParse::Bytecode> &function, const std::vector<double> &counts,
+                                                  const std::vector<bool> &own, LayoutReport &report) {
+        std::vector<Block> blocks;
+        for (size_t i = 0; i < function.size(); i++) {
+            bool starts = blocks.empty() || flow(function[i], vmParse::FlowCommand::LABEL) || endsBlock(blocks.back().code.back());
+            if (starts && (blocks.empty() || !blocks.back().code.empty())) {
+                blocks.emplace_back();
+                blocks.back().first = counts[i];
+            }
+            blocks.back().code.push_back(function[i]);
+            blocks.back().count = std::max(blocks.back().count, counts[i]);
+            blocks.back().last = counts[i];
+            blocks.back().counted = blocks.back().counted || own[i];
+        }
+
+        if (fallsThrough(blocks.back().code.back()) || blocks.front().cold()) { return function; }
+
+        std::vector<size_t> order;
+        for (size_t b = 0; b < blocks.size(); b++) {
+            if (!blocks[b].cold()) { order.push_back(b); }
+        }
+        auto hot = order.size();
+        for (size_t b = 0; b < blocks.size(); b++) {
+            if (blocks[b].cold()) { order.push_back(b); }
+        }
+        if (std::is_sorted(order.begin(), order.end())) { return function; }
+
+        std::vector<size_t> position(blocks.size());
+        for (size_t p = 0; p < order.size(); p++) {
+            position[order[p]] = p;
+            if (p >= hot && order[p] != p) { report.moved++; }
+        }
+        report.functions++;
+
+        // Keep every fall-through that no longer falls into the same block.
+        unsigned int labels = 0;
+        for (size_t b = 0; b + 1 < blocks.size(); b++) {
+            auto &block = blocks[b];
+            if (!fallsThrough(block.code.back()) || position[b + 1] == position[b] + 1) { continue; }
+
+            auto &next = blocks[b + 1];
+            auto label = flow(next.code.front(), vmParse::FlowCommand::LABEL);
+            std::string target = label ? label->label : "__vm_layout_" + std::to_string(labels++);
+            if (!label) { next.code.insert(next.code.begin(), vmParse::FlowBytecode {vmParse::FlowCommand::LABEL, target}); }
+            block.code.push_back(vmParse::FlowBytecode {vmParse::FlowCommand::GOTO, target, vmParse::lineOf(block.code.back())});
+            report.addedJumps++;
+            // It runs when the block ends without jumping, at most as often
+            // as the block's last command and the next block's first.
+            report.cyclesSaved -= 2 * std::min(block.last, next.first);
+        }
+
+        std::vector<vmParse::Bytecode> result;
+        for (size_t p = 0; p < order.size(); p++) {
+            const auto &block = blocks[order[p]];
+            for (const auto &bytecode : block.code) {
+                auto label = flow(bytecode, vmParse::FlowCommand::LABEL);
+                auto jump = result.empty() ? nullptr : flow(result.back(), vmParse::FlowCommand::GOTO);
+                if (label && jump && jump->label == label->label) {
+                    report.removedJumps++;
+                    report.cyclesSaved += 2 * blocks[order[p - 1]].last;
+                    result.pop_back();
+                }
+                result.push_back(bytecode);
+            }
+        }
+        return result;
+    }
+
+    vmProgram::Program layout(const vmProgram::Program &program, const Profile &profile, LayoutReport &report) {
+        vmProgram::Program result;
+        for (const auto &unit : program) {
+            std::vector<bool> unitOwn;
+            auto unitCounts = counts(unit.bytecode, profile, unitOwn);
+            vmProgram::Unit laidOut {unit.name, {}};
+            size_t start = 0;
+            for (const auto &function : vmPasses::splitFunctions(unit.bytecode)) {
+                std::vector<double> functionCounts(unitCounts.begin() + start, unitCounts.begin() + start + function.size());
+                std::vector<bool> functionOwn(unitOwn.begin() + start, unitOwn.begin() + start + function.size());
+                start += function.size();
+                auto entry = std::get_if<vmParse::FunctionBytecode>(&function.front());
+                bool inFunction = entry && entry->command == vmParse::FunctionCommand::FUNCTION;
+                if (inFunction && !profile.counted.count(entry->name)) { report.uncounted++; }
+                auto code = inFunction ? layoutFunction(function, functionCounts, functionOwn, report) : function;
+                laidOut.bytecode.insert(laidOut.bytecode.end(), code.begin(), code.end());
+            }
+            result.push_back(std::move(laidOut));
+        }
+        return result;
+    }
+
+    void print(const LayoutReport &layout, const vmBudget::BudgetReport &budget, std::ostream &out) {
+        auto placement = budget.cyclesSaved - budget.defaultCyclesSaved;
+        out << "Profile-guided code" << std::endl << "==========" << std::endl;
+        out << boost::format("%d cold blocks moved in %d functions") % layout.moved % layout.functions << std::endl;
+        out << boost::format("%d jumps removed, %d added") % layout.removedJumps % layout.addedJumps << std::endl;
+        out << boost::format("%.0f cycles saved by layout") % layout.cyclesSaved << std::endl;
+        out << boost::format("%.0f cycles saved by inlining hot sites and sharing cold ones") % placement << std::endl;
+        out << boost::format("%+.0f cycles estimated for the profiled run") % -(layout.cyclesSaved + placement) << std::endl;
+        if (layout.uncounted > 0) {
+            out << boost::format("At best: %d functions have only call and loop counts, which count branches not taken as run")
+                % layout.uncounted << std::endl;
+        }
+        out << std::endl;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "budget.hpp"
+#include "parse.hpp"
+#include "program.hpp"
+#include "sourcemap.hpp"
+
+namespace vmProfile {
+    // Counts from an earlier run of the program. A profile file has one
+    // count per line:
+    //
+    //     call COUNT FUNCTION          calls to FUNCTION
+    //     loop COUNT FUNCTION LABEL    jumps back to LABEL in FUNCTION
+    //     line COUNT FUNCTION LINE     runs of .vm line LINE inside FUNCTION
+    //
+    // hotness writes call and loop lines for an instrumented run, and
+    // lineCounts the line lines for a run counted per ROM address.
+    // Blank lines and lines starting with # are skipped.
+    struct Profile {
+        std::map<std::string, unsigned long> calls;
+        std::map<std::pair<std::string, std::string>, unsigned long> loops;
+        std::map<std::pair<std::string, unsigned int>, unsigned long> lines;
+        // Functions with line counts. Lines of theirs without one had no
+        // code of their own in the build that ran, folded into the line
+        // before by the passes.
+        std::set<std::string> counted;
+    };
+
+    Profile read(const std::string &path);
+    void write(const Profile &profile, const std::string &path);
+
+    // Runs per ROM address, one per line: either "address count", or a bare
+    // count for the next address up from 0, as an emulator's histogram of
+    // the program counter might list them.
+    std::map<uint32_t, unsigned long> readRuns(const std::string &path);
+
+    // Line counts for the build map came from: each .vm line runs as often
+    // as the first word of its code, the most of any of its ranges.
+    Profile lineCounts(const sourceMap::View &map, const std::map<uint32_t, unsigned long> &runs);
+
+    // Runs of each command: its line count where its function has them,
+    // otherwise the function's calls plus the jumps back of every loop the
+    // command is in. Generated commands, and those of lines without a
+    // count, run as often as the one before.
+    vmBudget::Hotness hotness(const vmProgram::Program &program, const Profile &profile);
+
+    struct LayoutReport {
+        unsigned int functions = 0;
+        // Blocks that never ran, moved to the end of their function.
+        unsigned int moved = 0;
+        // Jumps that became fall-throughs, and jumps added where a block
+        // no longer falls into the block it used to.
+        unsigned int removedJumps = 0;
+        unsigned int addedJumps = 0;
+        // Two cycles for each run of a removed jump, less the same for
+        // added ones.
+        double cyclesSaved = 0;
+        // Functions with only call and loop counts. Every command in one of
+        // their loops counts all its jumps back, branches not taken too, so
+        // the estimates are the most the profile could save.
+        unsigned int uncounted = 0;
+    };
+
+    // Move the blocks of each function that never ran behind those that
+    // did, so hot code falls through where it used to jump over cold code.
+    vmProgram::Program layout(const vmProgram::Program &program, const Profile &profile, LayoutReport &report);
+
+    // What the layout and the placement of sites by budget saved, and the
+    // cycles the profiled run should take less.
+    void print(const LayoutReport &layout, const vmBudget::BudgetReport &budget, std::ostream &out = std::cout);
+}
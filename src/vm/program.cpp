@@ -0,0 +1,533 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "program.hpp"
+
+/*
+Whole-program passes
+
+These run after every file is parsed and before any is optimized or
+translated on its own, since they need to see the calls between files.
+A function's body runs from its function command to the next function
+command or the end of its file.
+*/
+
+namespace vmProgram {
+    const vmParse::FunctionBytecode *functionCommand(const vmParse::Bytecode &bytecode, vmParse::FunctionCommand command) {
+        auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode);
+        return b && b->command == command ? b : nullptr;
+    }
+
+    bool defines(const Program &program, const std::string &function) {
+        for (const auto &unit : program) {
+            for (const auto &bytecode : unit.bytecode) {
+                if (auto b = functionCommand(bytecode, vmParse::FunctionCommand::FUNCTION); b && b->name == function) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    Program dropDeadFunctions(const Program &program, DeadFunctionReport &report) {
+        if (!defines(program, "Sys.init")) { return program; }
+
+        // Callees of each function; code outside any function is a root.
+        std::map<std::string, std::set<std::string>> callees;
+        std::vector<std::string> pending {"Sys.init"};
+        for (const auto &unit : program) {
+            std::string current;
+            for (const auto &bytecode : unit.bytecode) {
+                if (auto b = functionCommand(bytecode, vmParse::FunctionCommand::FUNCTION)) {
+                    current = b->name;
+                } else if (auto b = functionCommand(bytecode, vmParse::FunctionCommand::CALL)) {
+                    if (current.empty()) {
+                        pending.push_back(b->name);
+                    } else {
+                        callees[current].insert(b->name);
+                    }
+                }
+            }
+        }
+
+        std::set<std::string> live;
+        while (!pending.empty()) {
+            auto function = pending.back();
+            pending.pop_back();
+            if (!live.insert(function).second) { continue; }
+            for (const auto &callee : callees[function]) {
+                pending.push_back(callee);
+            }
+        }
+
+        Program result;
+        for (const auto &unit : program) {
+            Unit kept {unit.name, {}};
+            std::vector<vmParse::Bytecode> *dead = nullptr;
+            for (const auto &bytecode : unit.bytecode) {
+                if (auto b = functionCommand(bytecode, vmParse::FunctionCommand::FUNCTION)) {
+                    dead = live.count(b->name) ? nullptr : &report.removed[b->name];
+                }
+                (dead ? *dead : kept.bytecode).push_back(bytecode);
+            }
+            result.push_back(std::move(kept));
+        }
+        return result;
+    }
+
+    // What the inliner needs to know about a function it may inline.
+    struct Inlinable {
+        size_t unit;
+        unsigned int locals;
+        // Body between the function command and the return.
+        std::vector<vmParse::Bytecode> body;
+        // Highest argument index read or written, plus one.
+        unsigned int arguments = 0;
+        // Locals read before they're written, which still need zeroing.
+        std::set<unsigned int> zeroed;
+        std::set<unsigned int> pointers;
+        bool usesStatic = false;
+    };
+
+    // A body qualifies if it only pushes, pops and computes, never digs
+    // below its own frame and leaves exactly the return value behind.
+    std::optional<Inlinable> inlinable(size_t unit, unsigned int locals, const std::vector<vmParse::Bytecode> &body, unsigned int threshold) {
+        if (body.size() > threshold) { return std::nullopt; }
+
+        Inlinable result {unit, locals, body};
+        std::set<unsigned int> written;
+        int depth = 0;
+        for (const auto &bytecode : body) {
+            if (auto b = std::get_if<vmParse::LogicBytecode>(&bytecode)) {
+                bool unary = b->command == vmParse::LogicCommand::NEG || b->command == vmParse::LogicCommand::NOT;
+                if (depth < (unary ? 1 : 2)) { return std::nullopt; }
+                depth -= unary ? 0 : 1;
+            } else if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode)) {
+                bool push = b->command == vmParse::MemoryCommand::PUSH;
+                if (!push && depth < 1) { return std::nullopt; }
+                depth += push ? 1 : -1;
+
+                switch(b->segment) {
+                    case vmParse::MemorySegment::ARGUMENT:
+                        result.arguments = std::max(result.arguments, b->value + 1);
+                        break;
+                    case vmParse::MemorySegment::LOCAL:
+                        if (b->value >= locals) { return std::nullopt; }
+                        if (push && !written.count(b->value)) { result.zeroed.insert(b->value); }
+                        if (!push) { written.insert(b->value); }
+                        break;
+                    case vmParse::MemorySegment::POINTER:
+                        if (!push) { result.pointers.insert(b->value); }
+                        break;
+                    case vmParse::MemorySegment::STATIC:
+                        result.usesStatic = true;
+                        break;
+                    default:
+                        break;
+                }
+            } else {
+                return std::nullopt;
+            }
+        }
+        if (depth != 1) { return std::nullopt; }
+        return result;
+    }
+
+    std::map<std::string, Inlinable> findInlinable(const Program &program, unsigned int threshold) {
+        std::map<std::string, Inlinable> result;
+        for (size_t u = 0; u < program.size(); u++) {
+            const auto &bytecodes = program[u].bytecode;
+            for (size_t i = 0; i < bytecodes.size(); i++) {
+                auto function = functionCommand(bytecodes[i], vmParse::FunctionCommand::FUNCTION);
+                if (!function) { continue; }
+
+                auto end = i + 1;
+                while (end < bytecodes.size() && !functionCommand(bytecodes[end], vmParse::FunctionCommand::FUNCTION)) { end++; }
+                // The only return must be the last command.
+                if (end - i < 2 || !functionCommand(bytecodes[end - 1], vmParse::FunctionCommand::RETURN)) { continue; }
+
+                std::vector<vmParse::Bytecode> body(bytecodes.begin() + i + 1, bytecodes.begin() + end - 1);
+                if (auto candidate = inlinable(u, function->value, body, threshold)) {
+                    result.emplace(function->name, std::move(candidate.value()));
+                }
+            }
+        }
+        return result;
+    }
+
+    // The callee's arguments, then its locals, then saved pointers, all in
+    // caller locals from base up. The arguments are already on the stack.
+    // All of it counts as the call's line.
+    std::vector<vmParse::Bytecode> expand(const Inlinable &callee, unsigned int args, unsigned int base, unsigned int line) {
+        using vmParse::MemoryCommand;
+        using vmParse::MemorySegment;
+        std::vector<vmParse::Bytecode> result;
+        auto argumentSlot = [&](unsigned int i) { return base + i; };
+        auto localSlot = [&](unsigned int i) { return base + args + i; };
+        auto pointerSlot = [&](unsigned int i) { return base + args + callee.locals + i; };
+
+        for (auto i = args; i > 0; i--) {
+            result.push_back(vmParse::MemoryBytecode {MemoryCommand::POP, MemorySegment::LOCAL, argumentSlot(i - 1)});
+        }
+        for (auto i : callee.zeroed) {
+            result.push_back(vmParse::MemoryBytecode {MemoryCommand::PUSH, MemorySegment::CONSTANT, 0});
+            result.push_back(vmParse::MemoryBytecode {MemoryCommand::POP, MemorySegment::LOCAL, localSlot(i)});
+        }
+        for (auto i : callee.pointers) {
+            result.push_back(vmParse::MemoryBytecode {MemoryCommand::PUSH, MemorySegment::POINTER, i});
+            result.push_back(vmParse::MemoryBytecode {MemoryCommand::POP, MemorySegment::LOCAL, pointerSlot(i)});
+        }
+
+        for (auto bytecode : callee.body) {
+            if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode)) {
+                if (b->segment == MemorySegment::ARGUMENT) {
+                    *b = {b->command, MemorySegment::LOCAL, argumentSlot(b->value)};
+                } else if (b->segment == MemorySegment::LOCAL) {
+                    *b = {b->command, MemorySegment::LOCAL, localSlot(b->value)};
+                }
+            }
+            result.push_back(bytecode);
+        }
+
+        // The caller's this and that come back over the return value.
+        for (auto i : callee.pointers) {
+            result.push_back(vmParse::MemoryBytecode {MemoryCommand::PUSH, MemorySegment::LOCAL, pointerSlot(i)});
+            result.push_back(vmParse::MemoryBytecode {MemoryCommand::POP, MemorySegment::POINTER, i});
+        }
+        for (auto &bytecode : result) {
+            vmParse::setLine(bytecode, line);
+        }
+        return result;
+    }
+
+    // One round inlines calls to the current leaves. Callers whose calls
+    // were all inlined are leaves in the next round.
+    Program inlineFunctions(const Program &program, unsigned int threshold, unsigned int budget, InlineReport &report) {
+        Program result = program;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            auto candidates = findInlinable(result, threshold);
+
+            for (size_t u = 0; u < result.size(); u++) {
+                std::vector<vmParse::Bytecode> rewritten;
+                // Index in rewritten of the enclosing function command, and
+                // the extra locals its inlined calls need.
+                std::optional<size_t> caller;
+                unsigned int extra = 0;
+                auto growFrame = [&]() {
+                    if (!caller) { return; }
+                    std::get<vmParse::FunctionBytecode>(rewritten[caller.value()]).value += extra;
+                };
+
+                for (const auto &bytecode : result[u].bytecode) {
+                    if (functionCommand(bytecode, vmParse::FunctionCommand::FUNCTION)) {
+                        growFrame();
+                        caller = rewritten.size();
+                        extra = 0;
+                    }
+
+                    auto call = functionCommand(bytecode, vmParse::FunctionCommand::CALL);
+                    auto hit = call ? candidates.find(call->name) : candidates.end();
+                    if (!caller || hit == candidates.end()) {
+                        rewritten.push_back(bytecode);
+                        continue;
+                    }
+
+                    const auto &callee = hit->second;
+                    if (callee.arguments > call->value || (callee.usesStatic && callee.unit != u)) {
+                        rewritten.push_back(bytecode);
+                        continue;
+                    }
+
+                    auto base = std::get<vmParse::FunctionBytecode>(rewritten[caller.value()]).value;
+                    auto expanded = expand(callee, call->value, base, call->line);
+                    if (report.added + expanded.size() - 1 > budget) {
+                        report.budgetExhausted = true;
+                        rewritten.push_back(bytecode);
+                        continue;
+                    }
+
+                    report.added += expanded.size() - 1;
+                    report.inlined[call->name]++;
+                    extra = std::max(extra, call->value + callee.locals + static_cast<unsigned int>(callee.pointers.size() ? 2 : 0));
+                    rewritten.insert(rewritten.end(), expanded.begin(), expanded.end());
+                    changed = true;
+                }
+                growFrame();
+                result[u].bytecode = std::move(rewritten);
+            }
+        }
+        return result;
+    }
+
+    struct FunctionInfo {
+        // Highest argument index used, plus one, and the declared locals.
+        unsigned int arguments = 0;
+        unsigned int locals = 0;
+        std::set<std::string> callees;
+        // Index in the strongly connected component order.
+        size_t component = 0;
+        bool recursive = false;
+    };
+
+    std::map<std::string, FunctionInfo> callGraph(const Program &program) {
+        std::map<std::string, FunctionInfo> functions;
+        for (const auto &unit : program) {
+            FunctionInfo *current = nullptr;
+            for (const auto &bytecode : unit.bytecode) {
+                if (auto b = functionCommand(bytecode, vmParse::FunctionCommand::FUNCTION)) {
+                    current = &functions[b->name];
+                    current->locals = b->value;
+                } else if (!current) {
+                    continue;
+                } else if (auto b = functionCommand(bytecode, vmParse::FunctionCommand::CALL)) {
+                    current->callees.insert(b->name);
+                } else if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode); b && b->segment == vmParse::MemorySegment::ARGUMENT) {
+                    current->arguments = std::max(current->arguments, b->value + 1);
+                }
+            }
+        }
+        return functions;
+    }
+
+    // Tarjan's algorithm. Components come out callees first, so the reverse
+    // of the returned order is a topological order of the call graph.
+    std::vector<std::vector<std::string>> components(std::map<std::string, FunctionInfo> &functions) {
+        std::vector<std::vector<std::string>> result;
+        std::map<std::string, std::pair<size_t, size_t>> index;
+        std::vector<std::string> stack;
+        std::set<std::string> onStack;
+
+        std::function<void(const std::string &)> visit = [&](const std::string &name) {
+            auto order = index.size();
+            index[name] = {order, order};
+            stack.push_back(name);
+            onStack.insert(name);
+
+            for (const auto &callee : functions[name].callees) {
+                if (!functions.count(callee)) { continue; }
+                if (!index.count(callee)) {
+                    visit(callee);
+                    index[name].second = std::min(index[name].second, index[callee].second);
+                } else if (onStack.count(callee)) {
+                    index[name].second = std::min(index[name].second, index[callee].first);
+                }
+            }
+
+            if (index[name].first != index[name].second) { return; }
+            std::vector<std::string> component;
+            std::string member;
+            do {
+                member = stack.back();
+                stack.pop_back();
+                onStack.erase(member);
+                component.push_back(member);
+                functions[member].component = result.size();
+            } while (member != name);
+            result.push_back(component);
+        };
+
+        for (const auto &[name, info] : functions) {
+            if (!index.count(name)) { visit(name); }
+        }
+        for (auto &component : result) {
+            auto &first = functions[component.front()];
+            first.recursive = component.size() > 1 || first.callees.count(component.front());
+            for (const auto &member : component) {
+                functions[member].recursive = first.recursive;
+            }
+        }
+        return result;
+    }
+
+    Program allocateStaticFrames(const Program &program, unsigned int base, unsigned int limit, StaticFrameReport &report) {
+        if (!defines(program, "Sys.init")) { return program; }
+
+        auto functions = callGraph(program);
+        auto order = components(functions);
+
+        // A frame starts past every frame that can be live below it, which
+        // is the longest path to it through the callers' frames. Recursive
+        // functions keep their frames on the stack and add nothing.
+        std::vector<unsigned int> start(order.size(), 0);
+        for (auto c = order.size(); c > 0; c--) {
+            for (const auto &name : order[c - 1]) {
+                auto &info = functions[name];
+                unsigned int end = start[c - 1];
+                if (info.recursive) {
+                    report.recursive.push_back(name);
+                } else if (start[c - 1] + info.arguments + info.locals <= limit) {
+                    report.frames[name] = {base + start[c - 1], info.arguments + info.locals};
+                    end += info.arguments + info.locals;
+                }
+                report.words = std::max(report.words, end);
+
+                for (const auto &callee : info.callees) {
+                    if (!functions.count(callee)) { continue; }
+                    auto &calleeStart = start[functions[callee].component];
+                    calleeStart = std::max(calleeStart, end);
+                }
+            }
+        }
+
+        // Arguments are copied in from the stack on entry and locals zeroed,
+        // both straight into the frame.
+        Program result;
+        for (const auto &unit : program) {
+            Unit rewritten {unit.name, {}};
+            const std::pair<unsigned int, unsigned int> *frame = nullptr;
+            unsigned int arguments = 0;
+            for (const auto &bytecode : unit.bytecode) {
+                if (auto b = functionCommand(bytecode, vmParse::FunctionCommand::FUNCTION)) {
+                    auto hit = report.frames.find(b->name);
+                    frame = hit == report.frames.end() ? nullptr : &hit->second;
+                    if (!frame) {
+                        rewritten.bytecode.push_back(bytecode);
+                        continue;
+                    }
+
+                    arguments = functions[b->name].arguments;
+                    rewritten.bytecode.push_back(vmParse::FunctionBytecode {vmParse::FunctionCommand::FUNCTION, b->name, 0, vmParse::DEFAULT, b->line});
+                    for (unsigned int i = 0; i < arguments; i++) {
+                        rewritten.bytecode.push_back(vmParse::MoveBytecode {
+                            vmParse::MemorySegment::ARGUMENT, i, vmParse::MemorySegment::ABSOLUTE, frame->first + i, b->line
+                        });
+                    }
+                    for (unsigned int i = 0; i < b->value; i++) {
+                        rewritten.bytecode.push_back(vmParse::MoveBytecode {
+                            vmParse::MemorySegment::CONSTANT, 0, vmParse::MemorySegment::ABSOLUTE, frame->first + arguments + i, b->line
+                        });
+                    }
+                    continue;
+                }
+
+                auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode);
+                if (frame && b && b->segment == vmParse::MemorySegment::ARGUMENT) {
+                    rewritten.bytecode.push_back(vmParse::MemoryBytecode {b->command, vmParse::MemorySegment::ABSOLUTE, frame->first + b->value, b->line});
+                } else if (frame && b && b->segment == vmParse::MemorySegment::LOCAL) {
+                    rewritten.bytecode.push_back(vmParse::MemoryBytecode {b->command, vmParse::MemorySegment::ABSOLUTE, frame->first + arguments + b->value, b->line});
+                } else {
+                    rewritten.bytecode.push_back(bytecode);
+                }
+            }
+            result.push_back(std::move(rewritten));
+        }
+        return result;
+    }
+
+    // Statics live between the assembler's fixed registers and the stack.
+    const unsigned int firstStatic = 16;
+    const unsigned int lastStatic = 255;
+
+    Program packStatics(const Program &program, StaticPackingReport &report) {
+        // Accesses and reads of each static, keyed by its symbol.
+        std::map<std::string, std::pair<unsigned int, unsigned int>> counts;
+        auto symbol = [](const Unit &unit, unsigned int value) { return unit.name + "." + std::to_string(value); };
+        auto count = [&](const std::string &name, bool read) {
+            counts[name].first++;
+            if (read) { counts[name].second++; }
+        };
+
+        for (const auto &unit : program) {
+            for (const auto &bytecode : unit.bytecode) {
+                if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode); b && b->segment == vmParse::MemorySegment::STATIC) {
+                    count(symbol(unit, b->value), b->command == vmParse::MemoryCommand::PUSH);
+                } else if (auto b = std::get_if<vmParse::MoveBytecode>(&bytecode)) {
+                    if (b->fromSegment == vmParse::MemorySegment::STATIC) { count(symbol(unit, b->fromValue), true); }
+                    if (b->toSegment == vmParse::MemorySegment::STATIC) { count(symbol(unit, b->toValue), false); }
+                }
+            }
+        }
+
+        for (const auto &[name, accesses] : counts) {
+            if (accesses.second == 0) {
+                report.writeOnly.push_back(name);
+            } else {
+                report.packed.push_back({name, accesses.first, 0});
+            }
+        }
+        // Ties keep name order, so the layout is deterministic.
+        std::stable_sort(report.packed.begin(), report.packed.end(), [](const auto &a, const auto &b) { return a.accesses > b.accesses; });
+
+        std::map<std::string, unsigned int> addresses;
+        auto next = firstStatic;
+        for (auto &slot : report.packed) {
+            slot.address = next++;
+            addresses[slot.name] = slot.address;
+        }
+        for (const auto &name : report.writeOnly) {
+            addresses[name] = next;
+        }
+        if (!report.writeOnly.empty()) { next++; }
+        if (next > lastStatic + 1) {
+            throw std::out_of_range("Too many statics: " + std::to_string(next - firstStatic));
+        }
+
+        auto remap = [&](const Unit &unit, vmParse::MemorySegment &segment, unsigned int &value) {
+            if (segment != vmParse::MemorySegment::STATIC) { return; }
+            segment = vmParse::MemorySegment::ABSOLUTE;
+            value = addresses.at(symbol(unit, value));
+        };
+
+        Program result = program;
+        for (auto &unit : result) {
+            for (auto &bytecode : unit.bytecode) {
+                if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode)) {
+                    remap(unit, b->segment, b->value);
+                } else if (auto b = std::get_if<vmParse::MoveBytecode>(&bytecode)) {
+                    remap(unit, b->fromSegment, b->fromValue);
+                    remap(unit, b->toSegment, b->toValue);
+                }
+            }
+        }
+        return result;
+    }
+
+    void print(const InlineReport &report, std::ostream &out) {
+        unsigned int total = 0;
+        out << "Inlining" << std::endl << "==========" << std::endl;
+        for (const auto &[function, sites] : report.inlined) {
+            out << boost::format("%-30s %d sites") % function % sites << std::endl;
+            total += sites;
+        }
+        if (report.budgetExhausted) {
+            out << "ROM budget exhausted, some calls were not inlined" << std::endl;
+        }
+        out << boost::format("%d calls inlined, %d commands added") % total % report.added << std::endl << std::endl;
+    }
+
+    void print(const StaticFrameReport &report, std::ostream &out) {
+        out << "Static frames" << std::endl << "==========" << std::endl;
+        for (const auto &[function, frame] : report.frames) {
+            out << boost::format("%-30s %d words at %d") % function % frame.second % frame.first << std::endl;
+        }
+        for (const auto &function : report.recursive) {
+            out << boost::format("%-30s recursive, frame stays on the stack") % function << std::endl;
+        }
+        out << boost::format("%d functions, %d words of frames") % report.frames.size() % report.words << std::endl << std::endl;
+    }
+
+    void print(const StaticPackingReport &report, std::ostream &out) {
+        out << "Static packing" << std::endl << "==========" << std::endl;
+        for (const auto &slot : report.packed) {
+            out << boost::format("%-30s %d accesses at %d") % slot.name % slot.accesses % slot.address << std::endl;
+        }
+        for (const auto &name : report.writeOnly) {
+            out << boost::format("%-30s never read, dropped") % name << std::endl;
+        }
+        out << boost::format("%d statics in %d words") % (report.packed.size() + report.writeOnly.size())
+            % (report.packed.size() + (report.writeOnly.empty() ? 0 : 1))
+            << std::endl << std::endl;
+    }
+}
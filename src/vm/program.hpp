@@ -0,0 +1,83 @@
+#pragma once
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "parse.hpp"
+
+namespace vmProgram {
+    // One .vm file: its static namespace and its bytecode.
+    struct Unit {
+        std::string name;
+        std::vector<vmParse::Bytecode> bytecode;
+    };
+
+    // Every file being linked, in link order.
+    using Program = std::vector<Unit>;
+
+    bool defines(const Program &program, const std::string &function);
+
+    // Bodies of the functions that were dropped, keyed by name, each
+    // starting with its function command.
+    struct DeadFunctionReport {
+        std::map<std::string, std::vector<vmParse::Bytecode>> removed;
+    };
+
+    // Drop every function that no call chain from Sys.init, or from code
+    // outside any function, can reach. Programs without Sys.init are left
+    // alone, since we can't tell where they start.
+    Program dropDeadFunctions(const Program &program, DeadFunctionReport &report);
+
+    struct InlineReport {
+        // Call sites inlined, keyed by callee.
+        std::map<std::string, unsigned int> inlined;
+        unsigned int added = 0;
+        bool budgetExhausted = false;
+    };
+
+    // Replace calls to small leaf functions with their bodies. A function is
+    // inlined if its body is straight-line stack code of at most threshold
+    // commands ending in its only return. Its arguments and locals move to
+    // new local slots in the caller, so only callers that are functions
+    // themselves inline anything. Inlining stops once it would add more than
+    // budget commands to the program.
+    Program inlineFunctions(const Program &program, unsigned int threshold, unsigned int budget, InlineReport &report);
+
+    struct StaticFrameReport {
+        // Frame address and size, keyed by function.
+        std::map<std::string, std::pair<unsigned int, unsigned int>> frames;
+        // Words from base the frames take up, where the stack now starts.
+        unsigned int words = 0;
+        std::vector<std::string> recursive;
+    };
+
+    // Give every function that can't be active twice at once, that is any
+    // function on no cycle of the call graph, a fixed frame from base up,
+    // and turn its local and argument accesses into absolute ones. Frames
+    // of functions that are never active together share words. Only
+    // frames that fit within limit words are placed. Programs without
+    // Sys.init are left alone.
+    Program allocateStaticFrames(const Program &program, unsigned int base, unsigned int limit, StaticFrameReport &report);
+
+    struct StaticPackingReport {
+        struct Slot {
+            std::string name;
+            unsigned int accesses;
+            unsigned int address;
+        };
+        std::vector<Slot> packed;
+        // Statics that are written but never read all share one word.
+        std::vector<std::string> writeOnly;
+    };
+
+    // Give every static read anywhere in the program its own address from
+    // 16 up, most accessed first, and turn static accesses into absolute
+    // ones. Statics that are never read share a single word after them.
+    Program packStatics(const Program &program, StaticPackingReport &report);
+
+    void print(const InlineReport &report, std::ostream &out = std::cout);
+    void print(const StaticFrameReport &report, std::ostream &out = std::cout);
+    void print(const StaticPackingReport &report, std::ostream &out = std::cout);
+}
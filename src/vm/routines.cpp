@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "routines.hpp"
+
+/*
+Shared routines
+
+Code that would otherwise be repeated at every site is emitted once, ahead
+of the program, and sites jump to it with their return address in D. Each
+routine moves that address out of D into a scratch register first thing, so
+routines may use R13-R15 freely but never call one another.
+
+call    R13 = nArgs, R14 = callee. Pushes the return address and the caller's
+        LCL, ARG, THIS and THAT, repositions ARG and LCL and jumps to the
+        callee.
+return  No arguments or return address: the frame says where to go.
+        Copies the return value to ARG[0], restores the caller's frame and
+        jumps to the saved return address.
+tailcall  R13 = nArgs, R14 = callee, no return address. Replaces the
+        current frame: the new arguments go where the current ones are and
+        the saved frame moves up behind them if the argument count changed,
+        so the callee returns straight to our caller.
+eq/gt/lt  Pop two values and push the comparison, as the inline template.
+*/
+
+namespace vmRoutines {
+    std::string compareName(vmParse::LogicCommand command) {
+        switch(command) {
+            case vmParse::LogicCommand::EQ: return "eq";
+            case vmParse::LogicCommand::GT: return "gt";
+            case vmParse::LogicCommand::LT: return "lt";
+            default:
+                throw std::out_of_range("Not a comparison");
+        }
+    }
+
+    std::string compareJump(vmParse::LogicCommand command) {
+        switch(command) {
+            case vmParse::LogicCommand::EQ: return "JEQ";
+            case vmParse::LogicCommand::GT: return "JGT";
+            case vmParse::LogicCommand::LT: return "JLT";
+            default:
+                throw std::out_of_range("Not a comparison");
+        }
+    }
+
+    std::vector<std::string> compareBody(std::string jump, std::string label) {
+        return {
+            "@SP", "M=M-1", "A=M", "D=M",
+            "A=A-1", "D=M-D", "M=-1", "@" + label,
+            "D;" + jump, "@SP", "A=M-1", "M=0", "(" + label + ")"
+        };
+    }
+
+    std::vector<std::string> compareSite(vmParse::LogicCommand command, const std::string &returnLabel, Usage &usage) {
+        auto name = compareName(command);
+        usage[name]++;
+        return {"@" + returnLabel, "D=A", "@__vm_" + name, "0;JMP", "(" + returnLabel + ")"};
+    }
+
+    std::vector<std::string> functionEntry(const std::string &function, unsigned int locals) {
+        std::vector<std::string> result {"(" + function + ")"};
+        if (locals == 0) { return result; }
+
+        result.insert(result.end(), {"@SP", "A=M"});
+        for (unsigned int i = 0; i < locals; i++) {
+            result.insert(result.end(), {"M=0", "A=A+1"});
+        }
+        result.insert(result.end(), {"D=A", "@SP", "M=D"});
+        return result;
+    }
+
+    std::vector<std::string> callSite(const std::string &function, unsigned int args, const std::string &returnLabel, Usage &usage) {
+        usage["call"]++;
+        std::vector<std::string> result;
+        if (args <= 1) {
+            result.insert(result.end(), {"@R13", "M=" + std::to_string(args)});
+        } else {
+            result.insert(result.end(), {"@" + std::to_string(args), "D=A", "@R13", "M=D"});
+        }
+        result.insert(result.end(), {
+            "@" + function, "D=A", "@R14", "M=D",
+            "@" + returnLabel, "D=A", "@__vm_call", "0;JMP", "(" + returnLabel + ")"
+        });
+        return result;
+    }
+
+    std::vector<std::string> returnSite(Usage &usage) {
+        usage["return"]++;
+        return {"@__vm_return", "0;JMP"};
+    }
+
+    // The call routine with nArgs and the callee known, so R13 and R14 go.
+    std::vector<std::string> inlineCall(const std::string &function, unsigned int args, const std::string &returnLabel) {
+        std::vector<std::string> result {"@" + returnLabel, "D=A", "@SP", "A=M", "M=D"};
+        for (auto pointer : {"LCL", "ARG", "THIS", "THAT"}) {
+            result.insert(result.end(), {"@" + std::string(pointer), "D=M", "@SP", "AM=M+1", "M=D"});
+        }
+        result.insert(result.end(), {
+            "@SP", "MD=M+1", "@LCL", "M=D",
+            "@" + std::to_string(args + 5), "D=D-A", "@ARG", "M=D",
+            "@" + function, "0;JMP", "(" + returnLabel + ")"
+        });
+        return result;
+    }
+
+    std::vector<std::string> bootstrap(Usage &usage, unsigned int stackBase) {
+        std::vector<std::string> result {"@" + std::to_string(stackBase), "D=A", "@SP", "M=D"};
+        auto call = callSite("Sys.init", 0, "__vm_bootstrap", usage);
+        result.insert(result.end(), call.begin(), call.end());
+        return result;
+    }
+
+    std::vector<std::string> tailCallSite(const std::string &function, unsigned int args, Usage &usage) {
+        usage["tailcall"]++;
+        std::vector<std::string> result;
+        if (args <= 1) {
+            result.insert(result.end(), {"@R13", "M=" + std::to_string(args)});
+        } else {
+            result.insert(result.end(), {"@" + std::to_string(args), "D=A", "@R13", "M=D"});
+        }
+        result.insert(result.end(), {"@" + function, "D=A", "@R14", "M=D", "@__vm_tailcall", "0;JMP"});
+        return result;
+    }
+
+    std::vector<std::string> callRoutine() {
+        std::vector<std::string> result {"(__vm_call)", "@SP", "A=M", "M=D"};
+        for (auto pointer : {"LCL", "ARG", "THIS", "THAT"}) {
+            result.insert(result.end(), {"@" + std::string(pointer), "D=M", "@SP", "AM=M+1", "M=D"});
+        }
+        result.insert(result.end(), {
+            "@SP", "MD=M+1", "@LCL", "M=D",
+            "@R13", "D=D-M", "@5", "D=D-A", "@ARG", "M=D",
+            "@R14", "A=M", "0;JMP"
+        });
+        return result;
+    }
+
+    std::vector<std::string> inlineReturn() {
+        std::vector<std::string> result {
+            "@LCL", "D=M", "@R13", "M=D",
+            "@5", "A=D-A", "D=M", "@R14", "M=D",
+            "@SP", "AM=M-1", "D=M", "@ARG", "A=M", "M=D",
+            "@ARG", "D=M+1", "@SP", "M=D",
+        };
+        for (auto pointer : {"THAT", "THIS", "ARG", "LCL"}) {
+            result.insert(result.end(), {"@R13", "AM=M-1", "D=M", "@" + std::string(pointer), "M=D"});
+        }
+        result.insert(result.end(), {"@R14", "A=M", "0;JMP"});
+        return result;
+    }
+
+    std::vector<std::string> returnRoutine() {
+        std::vector<std::string> result {"(__vm_return)"};
+        auto body = inlineReturn();
+        result.insert(result.end(), body.begin(), body.end());
+        return result;
+    }
+
+    // The current frame holds LCL - ARG - 5 arguments. With the same count
+    // the saved frame is already in place and only the arguments move.
+    // Otherwise the saved frame is pushed behind the new arguments and both
+    // move down together. Either way the copy runs upwards from ARG, below
+    // everything it reads, with SP as the destination pointer.
+    std::vector<std::string> tailCallRoutine() {
+        std::vector<std::string> result {
+            "(__vm_tailcall)",
+            "@LCL", "D=M", "@5", "D=D-A", "@ARG", "D=D-M", "@R13", "D=D-M",
+            "@__vm_tailcall_copy", "D;JEQ",
+            "@LCL", "D=M", "@5", "D=D-A", "@R15", "M=D",
+        };
+        for (int i = 0; i < 5; i++) {
+            result.insert(result.end(), {"@R15", "AM=M+1", "A=A-1", "D=M", "@SP", "AM=M+1", "A=A-1", "M=D"});
+        }
+        result.insert(result.end(), {
+            "@5", "D=A", "@R13", "MD=D+M", "@ARG", "D=D+M", "@LCL", "M=D",
+            "(__vm_tailcall_copy)",
+            "@SP", "D=M", "@R13", "D=D-M", "@R15", "M=D", "@ARG", "D=M", "@SP", "M=D",
+            "@R13", "D=M", "@__vm_tailcall_jump", "D;JEQ",
+            "(__vm_tailcall_loop)",
+            "@R15", "AM=M+1", "A=A-1", "D=M", "@SP", "AM=M+1", "A=A-1", "M=D",
+            "@R13", "MD=M-1", "@__vm_tailcall_loop", "D;JGT",
+            "(__vm_tailcall_jump)",
+            "@LCL", "D=M", "@SP", "M=D", "@R14", "A=M", "0;JMP"
+        });
+        return result;
+    }
+
+    std::vector<std::string> compareRoutine(vmParse::LogicCommand command) {
+        auto name = compareName(command);
+        std::vector<std::string> result {"(__vm_" + name + ")", "@R13", "M=D"};
+        auto body = compareBody(compareJump(command), "__vm_" + name + "_end");
+        result.insert(result.end(), body.begin(), body.end());
+        result.insert(result.end(), {"@R13", "A=M", "0;JMP"});
+        return result;
+    }
+
+    std::vector<std::string> routine(const std::string &name) {
+        if (name == "call") { return callRoutine(); }
+        if (name == "return") { return returnRoutine(); }
+        if (name == "tailcall") { return tailCallRoutine(); }
+        for (auto command : {vmParse::LogicCommand::EQ, vmParse::LogicCommand::GT, vmParse::LogicCommand::LT}) {
+            if (name == compareName(command)) { return compareRoutine(command); }
+        }
+        throw std::out_of_range("Unknown routine " + name);
+    }
+
+    std::vector<std::string> withRoutines(const std::vector<std::string> &program, const Usage &usage) {
+        if (usage.empty()) { return program; }
+
+        // Execution still starts with the first command and runs off the end.
+        std::vector<std::string> result {"@__vm_start", "0;JMP"};
+        for (const auto &[name, calls] : usage) {
+            auto body = routine(name);
+            result.insert(result.end(), body.begin(), body.end());
+        }
+        result.push_back("(__vm_start)");
+        result.insert(result.end(), program.begin(), program.end());
+        return result;
+    }
+
+    std::vector<std::string> trailingRoutines(const Usage &usage) {
+        if (usage.empty()) { return {}; }
+
+        // Running off the end of the program still runs off the end of ROM.
+        std::vector<std::string> result {"@__vm_end", "0;JMP"};
+        for (const auto &[name, calls] : usage) {
+            auto body = routine(name);
+            result.insert(result.end(), body.begin(), body.end());
+        }
+        result.push_back("(__vm_end)");
+        return result;
+    }
+
+    std::vector<sourceMap::Mark> bootstrapMarks() {
+        return {{0, 0, "__vm_bootstrap"}};
+    }
+
+    std::vector<sourceMap::Mark> routineMarks(const Usage &usage) {
+        if (usage.empty()) { return {}; }
+
+        // The jump over the routines belongs to none of them.
+        std::vector<sourceMap::Mark> result {{0, 0, ""}};
+        size_t index = 2;
+        for (const auto &[name, calls] : usage) {
+            result.push_back({index, 0, "__vm_" + name});
+            index += routine(name).size();
+        }
+        return result;
+    }
+
+    unsigned int countWords(const std::vector<std::string> &lines) {
+        return std::count_if(lines.begin(), lines.end(), [](const std::string &line) { return line[0] != '('; });
+    }
+}
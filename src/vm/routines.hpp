@@ -0,0 +1,50 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "parse.hpp"
+#include "sourcemap.hpp"
+
+namespace vmRoutines {
+    // Shared routines a program calls, keyed by routine name ("eq", "call",
+    // ...), with the number of call sites.
+    using Usage = std::map<std::string, unsigned int>;
+
+    std::string compareName(vmParse::LogicCommand command);
+    std::string compareJump(vmParse::LogicCommand command);
+
+    // Pops y and x, leaves -1 in place of x if x-y satisfies jump, else 0.
+    std::vector<std::string> compareBody(std::string jump, std::string label);
+    std::vector<std::string> compareSite(vmParse::LogicCommand command, const std::string &returnLabel, Usage &usage);
+
+    std::vector<std::string> functionEntry(const std::string &function, unsigned int locals);
+    std::vector<std::string> callSite(const std::string &function, unsigned int args, const std::string &returnLabel, Usage &usage);
+    std::vector<std::string> returnSite(Usage &usage);
+    // What the call and return routines do, in place: longer, but without
+    // the jumps there and back or passing arguments through R13 and R14.
+    std::vector<std::string> inlineCall(const std::string &function, unsigned int args, const std::string &returnLabel);
+    std::vector<std::string> inlineReturn();
+    // Call function in place of the current one, on the current frame.
+    std::vector<std::string> tailCallSite(const std::string &function, unsigned int args, Usage &usage);
+
+    // SP = stackBase, then call Sys.init, which never returns.
+    std::vector<std::string> bootstrap(Usage &usage, unsigned int stackBase = 256);
+
+    std::vector<std::string> routine(const std::string &name);
+
+    // Put the routines in usage ahead of program, behind a jump over them.
+    std::vector<std::string> withRoutines(const std::vector<std::string> &program, const Usage &usage);
+    // The routines in usage to go after a program that has already been
+    // written, behind a jump to the end of ROM.
+    std::vector<std::string> trailingRoutines(const Usage &usage);
+
+    // Source map marks for the lines of bootstrap, and for the routines as
+    // withRoutines and trailingRoutines lay them out. Generated code has no
+    // line; each routine counts as a function of its own.
+    std::vector<sourceMap::Mark> bootstrapMarks();
+    std::vector<sourceMap::Mark> routineMarks(const Usage &usage);
+
+    unsigned int countWords(const std::vector<std::string> &lines);
+}
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <variant>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "optimize.hpp"
+#include "ssa.hpp"
+
+/*
+SSA value numbering
+
+Within an extended basic block -- straight-line code entered only at its
+top, though if-goto may leave it early -- every value the stack code
+computes is given a virtual register, and registers are numbered so that
+equal values share a number: a load gets the number of whatever was last
+stored to or loaded from the slot, a constant the number of that constant,
+and an operator the number of the same operator on the same operands.
+Values that were on the stack when the block began, and call results, get
+numbers of their own. Numbers are SSA values, so they stay valid to the end
+of the function; what a slot holds is forgotten at every label.
+
+The block is lowered back to stack code in its original order. The code for
+a value still on the stack runs from where it started to the end of what has
+been emitted, so it can be rewritten while it is on top:
+
+- CSE and copy propagation: a value that is a constant, or is held by a
+  slot, is pushed directly instead of recomputed, when its code is longer.
+- Redundant stores: storing a value to a slot that already holds it drops
+  the store and the value's code.
+- Dead stores: a store overwritten before anything could read it, or to the
+  frame just before return, is dropped with the value's code.
+
+Code can only be dropped if it has no effects, and jumps count as effects
+here: anything emitted while a value is on the stack makes its code impure.
+
+Slots are told apart with a simple alias model. Local and argument slots
+belong to the frame, which only this function can reach. Temp, static,
+pointer and absolute slots are fixed addresses, different from each other
+and from the frame. This and that slots go through a pointer, so they may
+be anything. A callee may read and write anything but the frame, and
+returning from it restores THIS and THAT.
+*/
+
+namespace vmSsa {
+    using Slot = std::pair<vmParse::MemorySegment, unsigned int>;
+    using Value = unsigned int;
+    // Stands in for the missing operand of neg and not.
+    const Value noValue = std::numeric_limits<Value>::max();
+
+    enum class Region { FRAME, FIXED, POINTER, INDIRECT };
+
+    Region region(const Slot &slot) {
+        switch(slot.first) {
+            case vmParse::MemorySegment::LOCAL:
+            case vmParse::MemorySegment::ARGUMENT:
+                return Region::FRAME;
+            case vmParse::MemorySegment::THIS:
+            case vmParse::MemorySegment::THAT:
+                return Region::INDIRECT;
+            case vmParse::MemorySegment::POINTER:
+                return Region::POINTER;
+            default:
+                return Region::FIXED;
+        }
+    }
+
+    bool isCommutative(vmParse::LogicCommand command) {
+        return command == vmParse::LogicCommand::ADD || command == vmParse::LogicCommand::AND
+            || command == vmParse::LogicCommand::OR || command == vmParse::LogicCommand::EQ;
+    }
+
+    // A value on the stack. Its code runs from start to the end of the
+    // output; pure code has no effects and needs nothing already on the
+    // stack, so it can be replaced as a whole.
+    struct Entry {
+        Value value;
+        size_t start;
+        bool pure;
+    };
+
+    // A store nothing has read yet: the value's code and the pop itself.
+    struct Store {
+        size_t start;
+        size_t end;
+    };
+
+    class Numbering {
+      public:
+        explicit Numbering(SsaReport &report) : report(report) {}
+
+        void run(const std::vector<vmParse::Bytecode> &bytecodes);
+        std::vector<vmParse::Bytecode> lower() const;
+
+      private:
+        Value constant(int16_t value);
+        Value apply(vmParse::LogicCommand command, std::optional<Value> x, Value y);
+        std::optional<Slot> holder(Value value) const;
+
+        void emit(const vmParse::Bytecode &bytecode);
+        void drop(size_t from);
+        void drop(size_t from, size_t to);
+        size_t length(size_t from) const;
+        Entry pop();
+        void effect();
+        void read(const Slot &slot);
+        void write(const Slot &slot, Value value, std::optional<Store> store);
+        bool rewrite(Entry &entry, unsigned int line);
+        void forgetBlock();
+        void forgetFunction();
+
+        void load(const vmParse::MemoryBytecode &bytecode);
+        void store(const vmParse::MemoryBytecode &bytecode);
+        void move(const vmParse::MoveBytecode &bytecode);
+        void logic(const vmParse::LogicBytecode &bytecode);
+
+        SsaReport &report;
+        // Dropped commands are left empty until lowering.
+        std::vector<std::optional<vmParse::Bytecode>> out;
+
+        Value next = 0;
+        std::map<int16_t, Value> constants;
+        std::map<Value, int16_t> constantOf;
+        std::map<std::tuple<vmParse::LogicCommand, Value, Value>, Value> operators;
+
+        std::vector<Entry> stack;
+        std::map<Slot, Value> known;
+        std::map<Slot, Store> unread;
+    };
+
+    Value Numbering::constant(int16_t value) {
+        auto [hit, added] = constants.emplace(value, next);
+        if (added) { constantOf[next++] = value; }
+        return hit->second;
+    }
+
+    // x is empty for neg and not.
+    Value Numbering::apply(vmParse::LogicCommand command, std::optional<Value> x, Value y) {
+        auto cx = x ? constantOf.find(x.value()) : constantOf.end();
+        auto cy = constantOf.find(y);
+        if (cy != constantOf.end() && (!x || cx != constantOf.end())) {
+            return constant(vmOptimize::fold(command, x ? cx->second : 0, cy->second).value());
+        }
+        auto first = x.value_or(noValue);
+        if (isCommutative(command) && y < first) { std::swap(first, y); }
+        auto [hit, added] = operators.emplace(std::make_tuple(command, first, y), next);
+        if (added) { next++; }
+        return hit->second;
+    }
+
+    // A slot holding value, preferring ones not reached through a pointer.
+    std::optional<Slot> Numbering::holder(Value value) const {
+        std::optional<Slot> result;
+        for (const auto &[slot, held] : known) {
+            if (held != value) { continue; }
+            if (region(slot) != Region::INDIRECT) { return slot; }
+            if (!result) { result = slot; }
+        }
+        return result;
+    }
+
+    void Numbering::emit(const vmParse::Bytecode &bytecode) {
+        out.push_back(bytecode);
+    }
+
+    void Numbering::drop(size_t from) {
+        drop(from, out.size());
+    }
+
+    void Numbering::drop(size_t from, size_t to) {
+        for (size_t i = from; i < to; i++) { out[i].reset(); }
+    }
+
+    size_t Numbering::length(size_t from) const {
+        return std::count_if(out.begin() + from, out.end(), [](const auto &b) { return b.has_value(); });
+    }
+
+    // Values from before the block have no code here to replace.
+    Entry Numbering::pop() {
+        if (stack.empty()) { return {next++, out.size(), false}; }
+        auto entry = stack.back();
+        stack.pop_back();
+        return entry;
+    }
+
+    void Numbering::effect() {
+        for (auto &entry : stack) { entry.pure = false; }
+    }
+
+    void Numbering::read(const Slot &slot) {
+        if (region(slot) == Region::INDIRECT) {
+            unread.clear();
+        } else {
+            unread.erase(slot);
+        }
+    }
+
+    void Numbering::write(const Slot &slot, Value value, std::optional<Store> store) {
+        // Storing through a pointer reads it.
+        if (region(slot) == Region::INDIRECT) {
+            read({vmParse::MemorySegment::POINTER, slot.first == vmParse::MemorySegment::THIS ? 0u : 1u});
+        }
+        if (auto hit = unread.find(slot); hit != unread.end()) {
+            drop(hit->second.start, hit->second.end + 1);
+            report.deadStores++;
+            unread.erase(hit);
+        }
+
+        auto forget = [&](auto predicate) {
+            for (auto i = known.begin(); i != known.end();) {
+                i = predicate(i->first) ? known.erase(i) : std::next(i);
+            }
+        };
+        switch(region(slot)) {
+            case Region::FRAME:
+            case Region::FIXED:
+                forget([](const Slot &s) { return region(s) == Region::INDIRECT; });
+                break;
+            case Region::POINTER: {
+                auto segment = slot.second == 0 ? vmParse::MemorySegment::THIS : vmParse::MemorySegment::THAT;
+                forget([&](const Slot &s) { return s.first == segment; });
+                break;
+            }
+            case Region::INDIRECT:
+                forget([](const Slot &s) { return region(s) != Region::POINTER; });
+                break;
+        }
+        known[slot] = value;
+
+        // The same this or that slot may be somewhere else by the next store.
+        if (store && region(slot) != Region::INDIRECT) {
+            unread[slot] = store.value();
+        }
+    }
+
+    // Push entry's value directly if that is shorter than computing it.
+    bool Numbering::rewrite(Entry &entry, unsigned int line) {
+        if (!entry.pure) { return false; }
+
+        std::vector<vmParse::Bytecode> code;
+        std::optional<Slot> slot;
+        if (auto hit = constantOf.find(entry.value); hit != constantOf.end()) {
+            vmOptimize::pushConstant(code, hit->second);
+        } else if ((slot = holder(entry.value))) {
+            code.push_back(vmParse::MemoryBytecode {vmParse::MemoryCommand::PUSH, slot->first, slot->second});
+        } else {
+            return false;
+        }
+
+        auto existing = length(entry.start);
+        auto single = existing == 1 && out.back() ? std::get_if<vmParse::MemoryBytecode>(&out.back().value()) : nullptr;
+        bool constantAlready = single && single->segment == vmParse::MemorySegment::CONSTANT;
+        if (code.size() > existing || (code.size() == existing && (slot || constantAlready))) { return false; }
+
+        drop(entry.start);
+        entry.start = out.size();
+        for (auto &b : code) {
+            vmParse::setLine(b, line);
+            emit(b);
+        }
+        if (slot) { read(slot.value()); }
+        report.reused++;
+        return true;
+    }
+
+    void Numbering::forgetBlock() {
+        stack.clear();
+        known.clear();
+        unread.clear();
+    }
+
+    void Numbering::forgetFunction() {
+        forgetBlock();
+        constants.clear();
+        constantOf.clear();
+        operators.clear();
+    }
+
+    void Numbering::load(const vmParse::MemoryBytecode &bytecode) {
+        Slot slot {bytecode.segment, bytecode.value};
+        Value value;
+        if (bytecode.segment == vmParse::MemorySegment::CONSTANT) {
+            value = constant(static_cast<int16_t>(bytecode.value));
+        } else {
+            auto hit = known.find(slot);
+            value = hit != known.end() ? hit->second : (known[slot] = next++);
+        }
+        emit(bytecode);
+        stack.push_back({value, out.size() - 1, true});
+        // The slot goes unread if a known constant is pushed instead.
+        if (!rewrite(stack.back(), bytecode.line) && bytecode.segment != vmParse::MemorySegment::CONSTANT) {
+            read(slot);
+        }
+    }
+
+    void Numbering::store(const vmParse::MemoryBytecode &bytecode) {
+        Slot slot {bytecode.segment, bytecode.value};
+        auto entry = pop();
+        if (auto hit = known.find(slot); hit != known.end() && hit->second == entry.value && entry.pure) {
+            drop(entry.start);
+            report.redundantStores++;
+            return;
+        }
+
+        emit(bytecode);
+        effect();
+        write(slot, entry.value, entry.pure ? std::optional<Store>(Store {entry.start, out.size() - 1}) : std::nullopt);
+    }
+
+    void Numbering::move(const vmParse::MoveBytecode &bytecode) {
+        Slot from {bytecode.fromSegment, bytecode.fromValue};
+        Slot to {bytecode.toSegment, bytecode.toValue};
+        Value value;
+        if (from.first == vmParse::MemorySegment::CONSTANT) {
+            value = constant(static_cast<int16_t>(bytecode.fromValue));
+        } else {
+            auto hit = known.find(from);
+            value = hit != known.end() ? hit->second : (known[from] = next++);
+            read(from);
+        }
+        if (auto hit = known.find(to); hit != known.end() && hit->second == value) {
+            report.redundantStores++;
+            return;
+        }
+
+        emit(bytecode);
+        effect();
+        write(to, value, Store {out.size() - 1, out.size() - 1});
+    }
+
+    void Numbering::logic(const vmParse::LogicBytecode &bytecode) {
+        bool unary = bytecode.command == vmParse::LogicCommand::NEG || bytecode.command == vmParse::LogicCommand::NOT;
+        auto y = pop();
+        auto x = unary ? y : pop();
+        emit(bytecode);
+        stack.push_back({apply(bytecode.command, unary ? std::nullopt : std::optional<Value>(x.value), y.value), x.start, x.pure && y.pure});
+        rewrite(stack.back(), bytecode.line);
+    }
+
+    void Numbering::run(const std::vector<vmParse::Bytecode> &bytecodes) {
+        for (const auto &bytecode : bytecodes) {
+            if (auto b = std::get_if<vmParse::LogicBytecode>(&bytecode)) {
+                logic(*b);
+            } else if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode); b && b->command == vmParse::MemoryCommand::PUSH) {
+                load(*b);
+            } else if (b && b->segment != vmParse::MemorySegment::CONSTANT) {
+                store(*b);
+            } else if (auto b = std::get_if<vmParse::MoveBytecode>(&bytecode)) {
+                move(*b);
+            } else if (auto b = std::get_if<vmParse::FlowBytecode>(&bytecode); b && b->command == vmParse::FlowCommand::IF_GOTO) {
+                // The fall-through path carries on with everything known,
+                // but whatever is stored may be read where the jump goes.
+                pop();
+                emit(bytecode);
+                effect();
+                unread.clear();
+            } else if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode); b && b->command == vmParse::FunctionCommand::CALL) {
+                for (unsigned int i = 0; i < b->value; i++) { pop(); }
+                emit(bytecode);
+                effect();
+                for (auto i = known.begin(); i != known.end();) {
+                    auto kept = region(i->first) == Region::FRAME || region(i->first) == Region::POINTER;
+                    i = kept ? std::next(i) : known.erase(i);
+                }
+                for (auto i = unread.begin(); i != unread.end();) {
+                    i = region(i->first) == Region::FRAME ? std::next(i) : unread.erase(i);
+                }
+                stack.push_back({next++, out.size(), false});
+            } else if (b && b->command == vmParse::FunctionCommand::RETURN) {
+                // Nothing reads the frame once it is gone.
+                for (const auto &[slot, store] : unread) {
+                    if (region(slot) != Region::FRAME) { continue; }
+                    drop(store.start, store.end + 1);
+                    report.deadStores++;
+                }
+                emit(bytecode);
+                forgetBlock();
+            } else if (b && b->command == vmParse::FunctionCommand::FUNCTION) {
+                forgetFunction();
+                emit(bytecode);
+            } else if (std::holds_alternative<vmParse::CountBytecode>(bytecode)) {
+                emit(bytecode);
+                effect();
+            } else {
+                // Labels, jumps, and anything an earlier pass made up.
+                emit(bytecode);
+                forgetBlock();
+            }
+        }
+    }
+
+    std::vector<vmParse::Bytecode> Numbering::lower() const {
+        std::vector<vmParse::Bytecode> result;
+        result.reserve(out.size());
+        for (const auto &b : out) {
+            if (b) { result.push_back(b.value()); }
+        }
+        return result;
+    }
+
+    std::vector<vmParse::Bytecode> optimize(const std::vector<vmParse::Bytecode> &bytecodes, SsaReport &report) {
+        Numbering numbering(report);
+        numbering.run(bytecodes);
+        auto result = numbering.lower();
+        report.before += bytecodes.size();
+        report.after += result.size();
+        return result;
+    }
+
+    void print(const SsaReport &report, std::ostream &out) {
+        out << "SSA value numbering" << std::endl << "==========" << std::endl;
+        out << boost::format("%d values pushed directly instead of recomputed") % report.reused << std::endl;
+        out << boost::format("%d redundant stores removed") % report.redundantStores << std::endl;
+        out << boost::format("%d dead stores removed") % report.deadStores << std::endl;
+        out << boost::format("%d -> %d commands") % report.before % report.after << std::endl << std::endl;
+    }
+}
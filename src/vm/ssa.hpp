@@ -0,0 +1,28 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+
+#include "parse.hpp"
+
+namespace vmSsa {
+    struct SsaReport {
+        // Computations replaced by a constant or by a push of a slot that
+        // already held their value.
+        unsigned int reused = 0;
+        // Stores of a value into a slot that already held it.
+        unsigned int redundantStores = 0;
+        // Stores nothing could read before the slot was written again or
+        // the frame went away.
+        unsigned int deadStores = 0;
+        unsigned int before = 0;
+        unsigned int after = 0;
+    };
+
+    // Number the values each extended basic block computes, then lower it
+    // back to stack code with recomputed values, copies and dead stores
+    // taken out.
+    std::vector<vmParse::Bytecode> optimize(const std::vector<vmParse::Bytecode> &bytecodes, SsaReport &report);
+
+    void print(const SsaReport &report, std::ostream &out = std::cout);
+}
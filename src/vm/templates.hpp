@@ -0,0 +1,45 @@
+// Generated by tools/superopt/superopt.cpp (make templates). Do not edit.
+//
+// Each template is the shortest straight-line Hack program with the
+// same effect on the stack as its VM code, found by exhaustive search.
+// Templates may clobber A, D and the free slots just above the stack.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace vmTemplates {
+    // add: 5 instructions, checked on 100000 random states
+    inline const std::vector<std::string> add {"@SP", "AM=M-1", "D=M", "A=A-1", "M=D+M"};
+
+    // sub: 5 instructions, checked on 100000 random states
+    inline const std::vector<std::string> sub {"@SP", "AM=M-1", "D=M", "A=A-1", "M=M-D"};
+
+    // and: 5 instructions, checked on 100000 random states
+    inline const std::vector<std::string> bitAnd {"@SP", "AM=M-1", "D=M", "A=A-1", "M=D&M"};
+
+    // or: 5 instructions, checked on 100000 random states
+    inline const std::vector<std::string> bitOr {"@SP", "AM=M-1", "D=M", "A=A-1", "M=D|M"};
+
+    // neg: 3 instructions, checked on 100000 random states
+    inline const std::vector<std::string> neg {"@SP", "A=M-1", "M=-M"};
+
+    // not: 3 instructions, checked on 100000 random states
+    inline const std::vector<std::string> bitNot {"@SP", "A=M-1", "M=!M"};
+
+    // push constant 0: 4 instructions, checked on 100000 random states
+    inline const std::vector<std::string> pushZero {"@SP", "A=M", "AM=0", "M=M+1"};
+
+    // push constant 1: 4 instructions, checked on 100000 random states
+    inline const std::vector<std::string> pushOne {"@SP", "M=M+1", "A=M-1", "M=1"};
+
+    // push constant 0; not: 4 instructions, checked on 100000 random states
+    inline const std::vector<std::string> pushTrue {"@SP", "M=M+1", "A=M-1", "M=-1"};
+
+    // push constant 1; add: 3 instructions, checked on 100000 random states
+    inline const std::vector<std::string> increment {"@SP", "A=M-1", "M=M+1"};
+
+    // push constant 1; sub: 3 instructions, checked on 100000 random states
+    inline const std::vector<std::string> decrement {"@SP", "A=M-1", "M=M-1"};
+}
@@ -1,65 +1,61 @@
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <variant>
 
+#include <boost/format.hpp>
+
+#include "../assemble/assemble.hpp"
+#include "binary.hpp"
+#include "budget.hpp"
+#include "cache.hpp"
+#include "cost.hpp"
+#include "instrument.hpp"
+#include "parallel.hpp"
 #include "parse.hpp"
+#include "passes.hpp"
+#include "profile.hpp"
+#include "program.hpp"
+#include "routines.hpp"
+#include "sourcemap.hpp"
+#include "templates.hpp"
+#include "vm.hpp"
 
 namespace vm {
-    std::vector<std::string> translateToStrings(vmParse::LogicBytecode *bytecode, unsigned int &currentLabel, std::string file_namespace) {
+    // Static frames may take this much of the 256-2047 stack area.
+    const unsigned int maxFrameWords = 1024;
+    // All of Hack ROM, the budget when a profile is given without one.
+    const unsigned int romWords = 32768;
+
+    std::vector<std::string> translateToStrings(vmParse::LogicBytecode *bytecode, unsigned int &currentLabel, std::string file_namespace,
+                                                const Options &options, vmRoutines::Usage &usage) {
         std::vector<std::string> result;        
         switch(bytecode->command) {
             case vmParse::LogicCommand::ADD:
-                return std::vector<std::string> {
-                    "@SP", "M=M-1", "A=M", "D=M",
-                    "A=A-1", "M=M+D"
-                };
+                return vmTemplates::add;
             case vmParse::LogicCommand::SUB:
-                return std::vector<std::string> {
-                    "@SP", "M=M-1", "A=M", "D=M",
-                    "A=A-1", "M=M-D"
-                };
+                return vmTemplates::sub;
             case vmParse::LogicCommand::NEG:
-                return std::vector<std::string> {
-                    "@SP", "A=M-1", "M=-M",
-                };
+                return vmTemplates::neg;
             case vmParse::LogicCommand::EQ:
-                currentLabel++;
-                return std::vector<std::string> {
-                    "@SP", "M=M-1", "A=M", "D=M",
-                    "A=A-1", "D=M-D", "M=-1", "@" + file_namespace + "_eqlabel_" + std::to_string(currentLabel),
-                    "D;JEQ", "@SP", "A=M-1", "M=0", "(eqlabel_" + std::to_string(currentLabel) + ")"
-                };
             case vmParse::LogicCommand::GT:
-                currentLabel++;
-                return std::vector<std::string> {
-                    "@SP", "M=M-1", "A=M", "D=M",
-                    "A=A-1", "D=M-D", "M=-1", "@" + file_namespace + "_gtlabel_" + std::to_string(currentLabel),
-                    "D;JGT", "@SP", "A=M-1", "M=0", "(gtlabel_" + std::to_string(currentLabel) + ")"
-                };            
             case vmParse::LogicCommand::LT:
                 currentLabel++;
-                return std::vector<std::string> {
-                    "@SP", "M=M-1", "A=M", "D=M",
-                    "A=A-1", "D=M-D", "M=-1", "@" + file_namespace + "_ltlabel_" + std::to_string(currentLabel),
-                    "D;JLT", "@SP", "A=M-1", "M=0", "(ltlabel_" + std::to_string(currentLabel) + ")"
-                };                        
+                if (bytecode->placement == vmParse::SHARED || (bytecode->placement == vmParse::DEFAULT && options.sharedCompare)) {
+                    auto returnLabel = file_namespace + "_" + vmRoutines::compareName(bytecode->command) + "return_" + std::to_string(currentLabel);
+                    return vmRoutines::compareSite(bytecode->command, returnLabel, usage);
+                }
+                return vmRoutines::compareBody(vmRoutines::compareJump(bytecode->command),
+                                               file_namespace + "_" + vmRoutines::compareName(bytecode->command) + "label_" + std::to_string(currentLabel));
             case vmParse::LogicCommand::AND:
-                currentLabel++;
-                return std::vector<std::string> {
-                    "@SP", "M=M-1", "A=M", "D=M",
-                    "A=A-1", "M=D&M"
-                };            
+                return vmTemplates::bitAnd;
             case vmParse::LogicCommand::OR:
-                currentLabel++;
-                return std::vector<std::string> {
-                    "@SP", "M=M-1", "A=M", "D=M",
-                    "A=A-1", "M=D|M"
-                };                                     
+                return vmTemplates::bitOr;
             case vmParse::LogicCommand::NOT:
-                return std::vector<std::string> {
-                    "@SP", "A=M-1", "M=!M"  
-                };                
+                return vmTemplates::bitNot;
             default:
                 throw std::out_of_range("Unreachable condition");
         }
@@ -105,6 +101,8 @@ namespace vm {
                         return {
                             "@SP", "M=M-1", "A=M", "D=M", "@" + std::to_string(3 + bytecode->value), "M=D",
                         };
+                    case vmParse::MemorySegment::ABSOLUTE:
+                        return {"@SP", "M=M-1", "A=M", "D=M", "@" + std::to_string(bytecode->value), "M=D"};
                     default:
                         throw std::out_of_range("Unreachable condition");                                    
                 }
@@ -119,6 +117,8 @@ namespace vm {
                     case vmParse::MemorySegment::THAT:                        
                         return simplePush("THAT", false, bytecode->value);
                     case vmParse::MemorySegment::CONSTANT:
+                        if (bytecode->value == 0) { return vmTemplates::pushZero; }
+                        if (bytecode->value == 1) { return vmTemplates::pushOne; }
                         return std::vector<std::string> {
                             "@" + std::to_string(bytecode->value), "D=A", "@SP",
                             "A=M", "M=D", "@SP", "M=M+1"
@@ -134,7 +134,9 @@ namespace vm {
                         return {
                             "@" + std::to_string(3 + bytecode->value), "D=M", "@SP", "M=M+1",
                             "A=M-1", "M=D",
-                        };                                             
+                        };
+                    case vmParse::MemorySegment::ABSOLUTE:
+                        return {"@" + std::to_string(bytecode->value), "D=M", "@SP", "M=M+1", "A=M-1", "M=D"};                                             
                     default:
                         throw std::out_of_range("Unreachable condition");                                    
                 }
@@ -145,36 +147,596 @@ namespace vm {
         return result;
     }
 
-    std::vector<std::string> translateToStrings(std::vector<vmParse::Bytecode> bytecodes, std::string file_namespace) {
-        unsigned int currentLabel = 0;        
+    std::vector<std::string> translateToStrings(vmParse::FlowBytecode *bytecode, std::string scope) {
+        auto label = vmCache::flowLabel(scope, bytecode->label);
+        switch(bytecode->command) {
+            case vmParse::FlowCommand::LABEL:
+                return {"(" + label + ")"};
+            case vmParse::FlowCommand::GOTO:
+                return {"@" + label, "0;JMP"};
+            case vmParse::FlowCommand::IF_GOTO:
+                return {"@SP", "AM=M-1", "D=M", "@" + label, "D;JNE"};
+            default:
+                throw std::out_of_range("Unreachable condition");
+        }
+    }
+
+    std::vector<std::string> translateToStrings(vmParse::CompareBranchBytecode *bytecode, std::string scope) {
+        return {
+            "@SP", "AM=M-1", "D=M", "@SP", "AM=M-1", "D=M-D",
+            "@" + vmCache::flowLabel(scope, bytecode->label), vmCache::branchJump(*bytecode)
+        };
+    }
+
+    // Labels and return addresses are scoped to the enclosing function, or
+    // to the file for code outside any function.
+    std::vector<std::string> translateToStrings(vmParse::FunctionBytecode *bytecode, unsigned int &currentLabel, std::string &scope,
+                                                vmRoutines::Usage &usage) {
+        switch(bytecode->command) {
+            case vmParse::FunctionCommand::FUNCTION:
+                scope = bytecode->name;
+                return vmRoutines::functionEntry(bytecode->name, bytecode->value);
+            case vmParse::FunctionCommand::CALL:
+                currentLabel++;
+                if (bytecode->placement == vmParse::INLINE) {
+                    return vmRoutines::inlineCall(bytecode->name, bytecode->value, scope + "$ret." + std::to_string(currentLabel));
+                }
+                return vmRoutines::callSite(bytecode->name, bytecode->value, scope + "$ret." + std::to_string(currentLabel), usage);
+            case vmParse::FunctionCommand::RETURN:
+                if (bytecode->placement == vmParse::INLINE) { return vmRoutines::inlineReturn(); }
+                return vmRoutines::returnSite(usage);
+            case vmParse::FunctionCommand::TAIL_CALL:
+                return vmRoutines::tailCallSite(bytecode->name, bytecode->value, usage);
+            default:
+                throw std::out_of_range("Unreachable condition");
+        }
+    }
+
+    // Two-command idioms with their own templates: push constant 1 followed
+    // by add or sub, and push constant 0 followed by not.
+    const std::vector<std::string> *pairTemplate(const std::vector<vmParse::Bytecode> &bytecodes, size_t i) {
+        if (i + 1 >= bytecodes.size()) { return nullptr; }
+        auto push = std::get_if<vmParse::MemoryBytecode>(&bytecodes[i]);
+        auto logic = std::get_if<vmParse::LogicBytecode>(&bytecodes[i + 1]);
+        if (!push || !logic || push->command != vmParse::MemoryCommand::PUSH || push->segment != vmParse::MemorySegment::CONSTANT) {
+            return nullptr;
+        }
+
+        if (push->value == 1 && logic->command == vmParse::LogicCommand::ADD) { return &vmTemplates::increment; }
+        if (push->value == 1 && logic->command == vmParse::LogicCommand::SUB) { return &vmTemplates::decrement; }
+        if (push->value == 0 && logic->command == vmParse::LogicCommand::NOT) { return &vmTemplates::pushTrue; }
+        return nullptr;
+    }
+
+    std::vector<std::string> translateToStrings(std::vector<vmParse::Bytecode> bytecodes, std::string file_namespace,
+                                                const Options &options, vmRoutines::Usage &usage, unsigned int &currentLabel,
+                                                std::vector<sourceMap::Mark> *marks) {
+        std::string scope = file_namespace;
         std::vector<std::string> result;
 
-        for (auto bytecode : bytecodes) {
-            if (auto b = std::get_if<vmParse::LogicBytecode>(&bytecode)) {
-                auto bStrings = translateToStrings(b, currentLabel, file_namespace);
+        for (size_t i = 0; i < bytecodes.size(); i++) {
+            auto bytecode = bytecodes[i];
+            vmCache::mark(marks, result, bytecode, scope);
+            if (auto idiom = pairTemplate(bytecodes, i)) {
+                result.insert(result.end(), idiom->begin(), idiom->end());
+                // The pair's code all counts as the first command's.
+                vmCache::mark(marks, result, bytecodes[++i], scope);
+            } else if (auto b = std::get_if<vmParse::LogicBytecode>(&bytecode)) {
+                auto bStrings = translateToStrings(b, currentLabel, file_namespace, options, usage);
                 result.insert(result.end(), bStrings.begin(), bStrings.end());
             } else if (auto b = std::get_if<vmParse::MemoryBytecode>(&bytecode)) {
                 auto bStrings = translateToStrings(b, file_namespace);
                 result.insert(result.end(), bStrings.begin(), bStrings.end());
+            } else if (auto b = std::get_if<vmParse::MoveBytecode>(&bytecode)) {
+                auto bStrings = vmCache::moveToStrings(*b, file_namespace);
+                result.insert(result.end(), bStrings.begin(), bStrings.end());
+            } else if (auto b = std::get_if<vmParse::FlowBytecode>(&bytecode)) {
+                auto bStrings = translateToStrings(b, scope);
+                result.insert(result.end(), bStrings.begin(), bStrings.end());
+            } else if (auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode)) {
+                auto bStrings = translateToStrings(b, currentLabel, scope, usage);
+                result.insert(result.end(), bStrings.begin(), bStrings.end());
+            } else if (auto b = std::get_if<vmParse::CompareBranchBytecode>(&bytecode)) {
+                auto bStrings = translateToStrings(b, scope);
+                result.insert(result.end(), bStrings.begin(), bStrings.end());
+            } else if (auto b = std::get_if<vmParse::CountBytecode>(&bytecode)) {
+                result.insert(result.end(), {"@" + std::to_string(b->address), "M=M+1"});
+            } else if (auto b = std::get_if<vmParse::ArrayBytecode>(&bytecode)) {
+                if (b->command == vmParse::MemoryCommand::PUSH) {
+                    vmCache::loadElementToD(result, *b, file_namespace);
+                    result.insert(result.end(), {"@SP", "M=M+1", "A=M-1", "M=D"});
+                } else {
+                    result.insert(result.end(), {"@SP", "AM=M-1", "D=M"});
+                    vmCache::storeElementFromD(result, *b, file_namespace);
+                }
             }
         }
         return result;
     }
 
-    void vm(std::string input, std::string output) {
-        std::filesystem::path p = output;
-        auto file_namespace = p.stem().string();
-        auto parsed_bytecode = vmParse::parseFile(std::move(input));
+    void printSharedReport(const vmRoutines::Usage &usage) {
+        std::cout << "Shared comparisons" << std::endl << "==========" << std::endl;
+        int totalSaved = 0;
+        bool shared = false;
+        for (auto command : {vmParse::LogicCommand::EQ, vmParse::LogicCommand::GT, vmParse::LogicCommand::LT}) {
+            auto hit = usage.find(vmRoutines::compareName(command));
+            if (hit == usage.end()) { continue; }
+            auto calls = hit->second;
+            shared = true;
 
-        auto translated = translateToStrings(parsed_bytecode, file_namespace);
+            vmRoutines::Usage scratch;
+            auto inlineWords = vmRoutines::countWords(vmRoutines::compareBody(vmRoutines::compareJump(command), "label"));
+            auto siteWords = vmRoutines::countWords(vmRoutines::compareSite(command, "label", scratch));
+            auto routineWords = vmRoutines::countWords(vmRoutines::routine(vmRoutines::compareName(command)));
+            // Everything the routine runs besides the inline body: the call
+            // site plus saving and jumping back through R13.
+            auto extraCycles = siteWords + routineWords - inlineWords;
 
-        std::ofstream output_file(output, std::ofstream::out | std::ofstream::trunc);
+            int saved = static_cast<int>(calls * inlineWords) - static_cast<int>(calls * siteWords + routineWords);
+            totalSaved += saved;
+            std::cout << boost::format("%-2s %d sites, %d -> %d words (%d saved), +%d cycles per call")
+                % vmRoutines::compareName(command)
+                % calls
+                % (calls * inlineWords)
+                % (calls * siteWords + routineWords)
+                % saved
+                % extraCycles
+                << std::endl;
+        }
+        if (shared) {
+            // The jump over the routines is paid once, at startup.
+            totalSaved -= 2;
+        }
+        std::cout << boost::format("%d words saved") % totalSaved << std::endl << std::endl;
+    }
+
+    std::vector<std::string> translate(const std::vector<vmParse::Bytecode> &bytecode, const std::string &file_namespace, const Options &options,
+                                       vmRoutines::Usage &usage, unsigned int &currentLabel, std::vector<sourceMap::Mark> *marks) {
+        return options.cacheTop || options.virtualSp
+            ? vmCache::translateToStrings(bytecode, file_namespace, options, usage, currentLabel, marks)
+            : translateToStrings(bytecode, file_namespace, options, usage, currentLabel, marks);
+    }
+
+    bool anyPass(const Options &options) {
+        const auto &passes = vmPasses::pipeline();
+        return std::any_of(passes.begin(), passes.end(), [&](const vmPasses::Pass &pass) { return options.*pass.enabled; });
+    }
+
+    bool wantsCost(const Options &options) {
+        return options.costReport || !options.costJson.empty();
+    }
+
+    // A .vm file translated on its own, with the routines it calls, where
+    // each command's code starts if a source map or cost report was asked
+    // for, and whatever its passes had to report.
+    struct Translation {
+        std::vector<std::string> lines;
+        vmRoutines::Usage usage;
+        std::vector<sourceMap::Mark> marks;
+        vmCost::CostReport cost;
+        std::string report;
+    };
+
+    // unit has been through the passes already, which left reports.
+    Translation translateUnit(const vmProgram::Unit &unit, const Options &options, const std::string &file, const vmPasses::Reports &reports) {
+        Translation translation;
+        unsigned int currentLabel = 0;
+        translation.lines = translate(unit.bytecode, unit.name, options, translation.usage, currentLabel,
+                                      options.sourceMap || wantsCost(options) ? &translation.marks : nullptr);
+        if (wantsCost(options)) { vmCost::add(translation.cost, file, unit.bytecode, translation.lines, translation.marks); }
+
+        std::ostringstream report;
+        vmPasses::print(reports, options, report);
+        translation.report = report.str();
+        return translation;
+    }
+
+    // Words program takes translated and linked.
+    unsigned int programWords(const vmProgram::Program &program, const Options &options, bool bootstrap) {
+        std::vector<unsigned int> words(program.size());
+        std::vector<vmRoutines::Usage> usages(program.size());
+        vmParallel::parallelFor(program.size(), options.jobs, [&](size_t i) {
+            unsigned int currentLabel = 0;
+            words[i] = vmRoutines::countWords(translate(program[i].bytecode, program[i].name, options, usages[i], currentLabel, nullptr));
+        });
+
+        vmRoutines::Usage usage;
+        for (const auto &u : usages) {
+            for (const auto &[name, calls] : u) { usage[name] += calls; }
+        }
+        std::vector<std::string> start;
+        if (bootstrap) { start = vmRoutines::bootstrap(usage); }
+        auto total = vmRoutines::countWords(vmRoutines::withRoutines(start, usage));
+        for (auto w : words) { total += w; }
+        return total;
+    }
+
+    void printDeadReport(const vmProgram::DeadFunctionReport &report, const Options &options) {
+        std::cout << "Dead functions" << std::endl << "==========" << std::endl;
+        unsigned int total = 0;
+        for (const auto &[function, body] : report.removed) {
+            // Words as this function would have been translated on its own.
+            vmPasses::Reports reports;
+            vmPasses::Stats stats;
+            auto bytecode = vmPasses::run(body, options, reports, stats);
+            auto words = vmRoutines::countWords(translateUnit({"dead", bytecode}, options, "", reports).lines);
+            total += words;
+            std::cout << boost::format("%-30s %d words") % function % words << std::endl;
+        }
+        std::cout << boost::format("%d functions removed, %d words saved") % report.removed.size() % total << std::endl << std::endl;
+    }
+
+    bool isBinary(const std::filesystem::path &path) {
+        return path.extension() == ".vmb";
+    }
+
+    std::vector<vmParse::Bytecode> loadFile(const std::filesystem::path &path) {
+        return isBinary(path) ? vmBinary::load(path.string()) : vmParse::parseFile(path.string());
+    }
+
+    // Both .vm and .vmb files, but only one of the two per class.
+    std::vector<std::filesystem::path> vmFiles(const std::string &directory) {
+        std::vector<std::filesystem::path> inputs;
+        for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+            if (entry.is_regular_file() && (entry.path().extension() == ".vm" || isBinary(entry.path()))) {
+                inputs.push_back(entry.path());
+            }
+        }
+        if (inputs.empty()) {
+            throw std::invalid_argument("No .vm files in " + directory);
+        }
+        std::sort(inputs.begin(), inputs.end());
+        for (size_t i = 1; i < inputs.size(); i++) {
+            if (inputs[i].stem() == inputs[i - 1].stem()) {
+                throw std::invalid_argument("Both .vm and .vmb for " + inputs[i].stem().string());
+            }
+        }
+        return inputs;
+    }
+
+    // The files to translate with their static namespaces: each file's stem
+    // in a directory, the output's stem for a single file.
+    std::vector<std::pair<std::filesystem::path, std::string>> inputFiles(const std::string &input, const std::string &output, bool directory) {
+        std::vector<std::pair<std::filesystem::path, std::string>> inputs;
+        if (directory) {
+            for (const auto &path : vmFiles(input)) { inputs.emplace_back(path, path.stem().string()); }
+        } else {
+            inputs.emplace_back(input, std::filesystem::path(output).stem().string());
+        }
+        return inputs;
+    }
+
+    // A .hack output is assembled from an .asm written next to it.
+    std::string asmPath(const std::string &output) {
+        std::filesystem::path p = output;
+        return p.extension() == ".hack" ? p.replace_extension(".asm").string() : output;
+    }
+
+    std::ofstream openOutput(const std::string &asmOutput) {
+        std::ofstream output_file(asmOutput, std::ofstream::out | std::ofstream::trunc);
         if (!output_file.is_open()) {
-            throw std::invalid_argument("Could not find file" + output);
-        }    
+            throw std::invalid_argument("Could not find file" + asmOutput);
+        }
+        return output_file;
+    }
+
+    void writeOutput(const std::vector<std::string> &lines, const std::string &output) {
+        auto asmOutput = asmPath(output);
+        auto output_file = openOutput(asmOutput);
+        for (const auto &line : lines) {
+            output_file << line << '\n';
+        }
+        output_file.close();
 
-        for (auto line : translated) {
-            output_file << line << std::endl;
-        }        
+        if (asmOutput != output) {
+            assemble::assemble(asmOutput, output);
+        }
+    }
+
+    void writeCost(const vmCost::CostReport &cost, const Options &options) {
+        if (options.costReport) { vmCost::print(cost); }
+        if (!options.costJson.empty()) {
+            std::ofstream json(options.costJson, std::ofstream::out | std::ofstream::trunc);
+            if (!json.is_open()) {
+                throw std::invalid_argument("Could not find file" + options.costJson);
+            }
+            vmCost::printJson(cost, json);
+        }
+    }
+
+    // Every per-file pass, and both translators, start afresh at a function
+    // command, so translating a file one function at a time gives the same
+    // code as translating it whole while holding only one function.
+    void streamFile(const std::filesystem::path &input, const std::string &file_namespace, const Options &options,
+                    std::ostream &out, vmRoutines::Usage &usage, vmPasses::Reports &reports, vmPasses::Stats &stats, sourceMap::Builder *map, vmCost::CostReport *cost,
+                    vmInstrument::Counters *counters, vmInstrument::Statics &statics) {
+        unsigned int currentLabel = 0;
+        std::vector<vmParse::Bytecode> function;
+        std::vector<sourceMap::Mark> marks;
+        auto flush = [&]() {
+            if (counters) {
+                vmInstrument::addStatics(function, file_namespace, statics);
+                function = vmInstrument::instrument(function, input.string(), *counters);
+            }
+            auto bytecode = vmPasses::run(std::move(function), options, reports, stats);
+            auto lines = translate(bytecode, file_namespace, options, usage, currentLabel, map || cost ? &marks : nullptr);
+            for (const auto &line : lines) {
+                out << line << '\n';
+            }
+            if (map) { map->append(lines, marks, input.string()); }
+            if (cost) { vmCost::add(*cost, input.string(), bytecode, lines, marks); }
+            function.clear();
+            marks.clear();
+        };
+
+        auto add = [&](vmParse::Bytecode bytecode) {
+            auto b = std::get_if<vmParse::FunctionBytecode>(&bytecode);
+            if (b && b->command == vmParse::FunctionCommand::FUNCTION) { flush(); }
+            function.push_back(std::move(bytecode));
+        };
+
+        if (isBinary(input)) {
+            // Mapped, so only the pages in use are resident.
+            vmBinary::View view(input.string());
+            for (size_t i = 0; i < view.size(); i++) { add(view[i]); }
+        } else {
+            std::ifstream input_file {input};
+            if (!input_file.is_open()) {
+                throw std::invalid_argument("Could not find file" + input.string());
+            }
+            std::string line;
+            unsigned int number = 0;
+            while (std::getline(input_file, line)) {
+                number++;
+                if (auto bytecode = vmParse::parseLine(line)) {
+                    vmParse::setLine(bytecode.value(), number);
+                    add(std::move(bytecode.value()));
+                }
+            }
+        }
+        flush();
+    }
+
+    // Files are read, translated and written in order, so memory doesn't
+    // grow with the input. With no program to look at ahead of time, the
+    // bootstrap goes in if the directory has a Sys.vm, and the shared
+    // routines go after the program.
+    void streamVm(const std::string &input, const std::string &output, bool directory, const Options &options) {
+        if (options.inlineThreshold > 0 || options.dropDeadFunctions || options.staticFrames || options.packStatics || options.romBudget > 0 ||
+            !options.profile.empty()) {
+            throw std::invalid_argument("Whole-program passes can't run on a stream");
+        }
+
+        auto asmOutput = asmPath(output);
+        auto output_file = openOutput(asmOutput);
+        vmRoutines::Usage usage;
+        vmPasses::Reports reports;
+        vmPasses::Stats stats;
+        sourceMap::Builder map;
+        vmCost::CostReport cost;
+        vmInstrument::Counters counters;
+        vmInstrument::Statics statics;
+
+        auto sys = std::filesystem::path(input) / "Sys";
+        if (directory && (std::filesystem::exists(sys.replace_extension(".vm")) || std::filesystem::exists(sys.replace_extension(".vmb")))) {
+            auto lines = vmRoutines::bootstrap(usage);
+            for (const auto &line : lines) { output_file << line << '\n'; }
+            map.append(lines, vmRoutines::bootstrapMarks(), "");
+            cost.bootstrapWords = vmRoutines::countWords(lines);
+        }
+        for (const auto &[path, file_namespace] : inputFiles(input, output, directory)) {
+            streamFile(path, file_namespace, options, output_file, usage, reports, stats, options.sourceMap ? &map : nullptr,
+                       wantsCost(options) ? &cost : nullptr, options.instrument ? &counters : nullptr, statics);
+        }
+        if (options.instrument) {
+            vmInstrument::checkRoom(counters, statics);
+            vmInstrument::write(counters, vmInstrument::countersPath(output));
+        }
+        auto routines = vmRoutines::trailingRoutines(usage);
+        for (const auto &line : routines) { output_file << line << '\n'; }
+        output_file.close();
+
+        if (options.sourceMap) {
+            map.append(routines, vmRoutines::routineMarks(usage), "");
+            map.write(sourceMap::mapPath(output));
+        }
+
+        if (options.report) {
+            vmPasses::print(reports, options, std::cout);
+            if (anyPass(options)) { vmPasses::print(stats, options, std::cout); }
+        }
+        if (options.sharedCompare && options.report) { printSharedReport(usage); }
+        cost.routineWords = vmRoutines::countWords(routines);
+        writeCost(cost, options);
+
+        if (asmOutput != output) {
+            assemble::assemble(asmOutput, output);
+        }
+    }
+
+    // Levels only turn passes on, so flags given alongside -O still count.
+    void setOptimizationLevel(Options &options, unsigned int level) {
+        if (level >= 1) {
+            options.foldConstants = true;
+            options.fuseArrays = true;
+            options.fuseMoves = true;
+            options.fuseBranches = true;
+            options.tailCalls = true;
+            options.cacheTop = true;
+            options.virtualSp = true;
+        }
+        if (level >= 2) {
+            options.ssa = true;
+        }
+    }
+
+    void enablePass(Options &options, const std::string &name, bool enabled) {
+        vmPasses::enable(options, name, enabled);
+    }
+
+    // A directory is parsed and translated one file per worker, each file
+    // with its own static namespace and label counter, with whole-program
+    // passes in between and per-function passes one function per worker.
+    // The files are then linked: bootstrap first if some file defines
+    // Sys.init, then the files in name order.
+    void vm(std::string input, std::string output, Options options) {
+        bool directory = std::filesystem::is_directory(input);
+        if (isBinary(output)) {
+            // Parsed bytecode only; passes and translation wait for the
+            // program it ends up in.
+            if (directory) { throw std::invalid_argument("A .vmb holds one file; translate each .vm on its own"); }
+            vmBinary::write(loadFile(input), output);
+            return;
+        }
+
+        if (options.stream) {
+            streamVm(input, output, directory, options);
+            return;
+        }
+
+        auto inputs = inputFiles(input, output, directory);
+        vmProgram::Program program(inputs.size());
+        vmParallel::parallelFor(inputs.size(), options.jobs, [&](size_t i) {
+            program[i] = {inputs[i].second, loadFile(inputs[i].first)};
+        });
+
+        if (options.inlineThreshold > 0) {
+            vmProgram::InlineReport report;
+            program = vmProgram::inlineFunctions(program, options.inlineThreshold, options.inlineBudget, report);
+            if (options.report) { vmProgram::print(report); }
+        }
+
+        // After inlining, which may leave functions without callers.
+        if (options.dropDeadFunctions) {
+            vmProgram::DeadFunctionReport report;
+            program = vmProgram::dropDeadFunctions(program, report);
+            if (options.report) { printDeadReport(report, options); }
+        }
+
+        // Frames go where the stack would start, and the stack moves up past
+        // them, so this needs the bootstrap.
+        unsigned int stackBase = 256;
+        if (options.staticFrames && directory) {
+            vmProgram::StaticFrameReport report;
+            program = vmProgram::allocateStaticFrames(program, stackBase, maxFrameWords, report);
+            stackBase += report.words;
+            if (options.report) { vmProgram::print(report); }
+        }
+
+        if (options.packStatics) {
+            vmProgram::StaticPackingReport report;
+            program = vmProgram::packStatics(program, report);
+            if (options.report) { vmProgram::print(report); }
+        }
+
+        // Block order follows the code the profile was taken from, so this
+        // comes before anything that reshapes functions for translation.
+        vmProfile::Profile profile;
+        vmProfile::LayoutReport layout;
+        if (!options.profile.empty()) {
+            profile = vmProfile::read(options.profile);
+            program = vmProfile::layout(program, profile, layout);
+        }
+
+        // Last, so counters measure the program as it will run. In order,
+        // so slots don't depend on threads.
+        if (options.instrument) {
+            vmInstrument::Counters counters;
+            vmInstrument::Statics statics;
+            for (size_t i = 0; i < program.size(); i++) {
+                vmInstrument::addStatics(program[i].bytecode, program[i].name, statics);
+                program[i].bytecode = vmInstrument::instrument(program[i].bytecode, inputs[i].first.string(), counters);
+            }
+            vmInstrument::checkRoom(counters, statics);
+            vmInstrument::write(counters, vmInstrument::countersPath(output));
+        }
+
+        std::vector<vmPasses::Reports> reports;
+        vmPasses::Stats stats;
+        program = vmPasses::run(program, options, reports, stats);
+
+        // Last, on the code as it will be translated.
+        bool bootstrap = directory && vmProgram::defines(program, "Sys.init");
+        vmBudget::BudgetReport budget;
+        bool placing = options.romBudget > 0 || !options.profile.empty();
+        if (placing) {
+            auto hotness = options.profile.empty() ? vmBudget::loopHotness(program) : vmProfile::hotness(program, profile);
+            auto sites = vmBudget::shareAll(program, options, hotness);
+            budget.budget = options.romBudget > 0 ? options.romBudget : romWords;
+            budget.sharedWords = programWords(program, options, bootstrap);
+            if (budget.sharedWords > budget.budget && options.romBudget > 0) {
+                throw std::out_of_range((boost::format("The program takes %d words with every site shared, over the budget of %d")
+                                         % budget.sharedWords % options.romBudget).str());
+            }
+            auto spare = budget.sharedWords > budget.budget ? 0 : budget.budget - budget.sharedWords;
+            if (!options.profile.empty() && options.romBudget > 0) {
+                // Without the profile, the budget would go by loop depth.
+                auto depth = vmBudget::loopHotness(program);
+                auto byDepth = sites;
+                for (auto &site : byDepth) { site.hotness = depth[site.unit][site.index]; }
+                auto chosen = vmBudget::choose(byDepth, spare);
+                for (size_t i = 0; i < sites.size(); i++) { sites[i].inlinedByDefault = chosen[i]; }
+            }
+            vmBudget::inlineWithin(program, sites, spare, budget);
+        }
+
+        std::vector<Translation> translations(program.size());
+        vmParallel::parallelFor(program.size(), options.jobs, [&](size_t i) {
+            translations[i] = translateUnit(program[i], options, inputs[i].first.string(), reports[i]);
+        });
+
+        vmRoutines::Usage usage;
+        std::vector<std::string> start;
+        if (bootstrap) {
+            start = vmRoutines::bootstrap(usage, stackBase);
+        }
+
+        std::vector<std::string> linked = start;
+
+        for (size_t i = 0; i < translations.size(); i++) {
+            const auto &translation = translations[i];
+            linked.insert(linked.end(), translation.lines.begin(), translation.lines.end());
+            for (const auto &[name, calls] : translation.usage) {
+                usage[name] += calls;
+            }
+
+            if (options.report && !translation.report.empty()) {
+                if (directory) { std::cout << inputs[i].first.filename().string() << std::endl << std::endl; }
+                std::cout << translation.report;
+            }
+        }
+        if (options.report && anyPass(options)) { vmPasses::print(stats, options); }
+        if (options.sharedCompare && options.report) { printSharedReport(usage); }
+
+        if (wantsCost(options)) {
+            vmCost::CostReport cost;
+            for (const auto &translation : translations) { vmCost::merge(cost, translation.cost); }
+            cost.bootstrapWords = vmRoutines::countWords(start);
+            cost.routineWords = vmRoutines::countWords(vmRoutines::withRoutines({}, usage));
+            writeCost(cost, options);
+        }
+
+        if (options.sourceMap) {
+            // In ROM order: the routines, the bootstrap, then each file.
+            sourceMap::Builder map;
+            map.append(vmRoutines::withRoutines({}, usage), vmRoutines::routineMarks(usage), "");
+            map.append(start, vmRoutines::bootstrapMarks(), "");
+            for (size_t i = 0; i < translations.size(); i++) {
+                map.append(translations[i].lines, translations[i].marks, inputs[i].first.string());
+            }
+            map.write(sourceMap::mapPath(output));
+        }
+
+        auto lines = vmRoutines::withRoutines(linked, usage);
+        if (placing && options.report) {
+            budget.words = vmRoutines::countWords(lines);
+            vmBudget::print(budget);
+            if (!options.profile.empty()) { vmProfile::print(layout, budget); }
+        }
+        writeOutput(lines, output);
     }   
+
+    void lineProfile(const std::string &map, const std::string &runs, const std::string &output) {
+        vmProfile::write(vmProfile::lineCounts(sourceMap::View(map), vmProfile::readRuns(runs)), output);
+    }
 }
\ No newline at end of file
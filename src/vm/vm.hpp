@@ -1,3 +1,62 @@
+#pragma once
+
+#include <string>
+
 namespace vm {
-  void vm(std::string, std::string);
+  struct Options {
+    bool cacheTop = false;
+    bool virtualSp = false;
+    // Number the values of each block and drop recomputations, copies and
+    // dead stores, ahead of the other per-file passes.
+    bool ssa = false;
+    bool foldConstants = false;
+    bool fuseArrays = false;
+    bool fuseMoves = false;
+    bool fuseBranches = false;
+    bool sharedCompare = false;
+    bool tailCalls = false;
+    bool dropDeadFunctions = false;
+    bool staticFrames = false;
+    bool packStatics = false;
+    // Inline leaf functions of at most this many commands; 0 turns it off.
+    unsigned int inlineThreshold = 0;
+    // Most commands inlining may add to the whole program.
+    unsigned int inlineBudget = 1000;
+    // Translate one function at a time instead of whole files.
+    bool stream = false;
+    // Most words of ROM the program may take. Comparisons, calls and returns
+    // are inlined where they save the most cycles for the words they add,
+    // hotter sites (deeper in loops) first; 0 leaves it to the other options.
+    unsigned int romBudget = 0;
+    // Counts from an earlier run (see vmProfile::Profile). Sites are placed
+    // by how often they ran instead of by loop depth, within all of ROM if
+    // there is no budget, and blocks that never ran move out of the way.
+    std::string profile;
+    // Workers for parsing, per-function passes and translation; 0 uses one
+    // per hardware thread. The output is the same for any number.
+    unsigned int jobs = 0;
+    // Count function entries and loop back-edges in RAM from the top of the
+    // static area down, listing the counters in a .counters file next to
+    // the output.
+    bool instrument = false;
+    // Write a .map from ROM addresses to .vm lines next to the output.
+    bool sourceMap = false;
+    // Print the words each file, function and kind of command costs, and
+    // write the same as JSON to costJson if it is set.
+    bool costReport = false;
+    std::string costJson;
+    bool report = false;
+  };
+
+  // -O: 1 turns on the per-file passes and stack caching, 2 adds ssa.
+  void setOptimizationLevel(Options &options, unsigned int level);
+  // Turn a per-function pass on or off by name, as --enable-pass and
+  // --disable-pass do after -O and the pass flags.
+  void enablePass(Options &options, const std::string &name, bool enabled);
+
+  void vm(std::string, std::string, Options = {});
+
+  // Write a profile of line counts for --profile from the .map of a build
+  // and the runs of each of its ROM addresses.
+  void lineProfile(const std::string &map, const std::string &runs, const std::string &output);
 }
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+Hotness report for instrumented programs
+
+Reads the .counters file `nand vm --instrument` wrote and a dump of RAM
+taken after running the program, and prints the counters, hottest first.
+Build with `make hotness`:
+
+    hotness Prog.counters ram.txt [Prog.profile]
+
+Given a third file, it also writes the counts there as a profile for
+`nand vm --profile`: a "call COUNT FUNCTION" line per function and a
+"loop COUNT FUNCTION LABEL" line per loop. These place calls and returns, but
+say nothing of branches inside a loop, so no block looks cold; for that, count
+runs per ROM address instead and turn them into line counts with
+`nand profile`.
+
+The dump is text, one word per line: either "address value", or a bare
+value for the next address up from 0. Values may be written signed or
+unsigned; counters are read as unsigned 16-bit counts, so a count past 65535
+will have wrapped.
+*/
+
+namespace hotness {
+    struct Counter {
+        unsigned int address;
+        std::string function;
+        std::string label;
+        std::string source;
+        unsigned int count = 0;
+    };
+
+    std::vector<Counter> readCounters(const std::string &path) {
+        std::ifstream input {path};
+        if (!input.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+        std::vector<Counter> counters;
+        std::string line;
+        while (std::getline(input, line)) {
+            std::istringstream fields {line};
+            Counter counter;
+            if (!(fields >> counter.address >> counter.function >> counter.label)) { continue; }
+            std::getline(fields >> std::ws, counter.source);
+            counters.push_back(counter);
+        }
+        return counters;
+    }
+
+    std::map<unsigned int, uint16_t> readRam(const std::string &path) {
+        std::ifstream input {path};
+        if (!input.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+        std::map<unsigned int, uint16_t> ram;
+        unsigned int next = 0;
+        std::string line;
+        while (std::getline(input, line)) {
+            std::replace(line.begin(), line.end(), ':', ' ');
+            std::istringstream fields {line};
+            long first, second;
+            if (!(fields >> first)) { continue; }
+            if (fields >> second) {
+                next = first;
+                first = second;
+            }
+            ram[next++] = static_cast<uint16_t>(first);
+        }
+        return ram;
+    }
+
+    void print(const std::string &title, std::vector<Counter> counters) {
+        std::stable_sort(counters.begin(), counters.end(), [](const Counter &a, const Counter &b) { return a.count > b.count; });
+        unsigned long total = 0;
+        for (const auto &counter : counters) { total += counter.count; }
+
+        std::cout << title << std::endl << "==========" << std::endl;
+        for (const auto &counter : counters) {
+            auto name = counter.label == "-" ? counter.function : counter.function + " " + counter.label;
+            std::cout << std::setw(8) << counter.count << "  "
+                      << std::setw(5) << std::fixed << std::setprecision(1) << (total ? 100.0 * counter.count / total : 0.0) << "%  "
+                      << std::left << std::setw(40) << name << std::right << " " << counter.source << std::endl;
+        }
+        std::cout << total << " total" << std::endl << std::endl;
+    }
+
+    void writeProfile(const std::string &path, const std::vector<Counter> &counters) {
+        std::ofstream output {path, std::ofstream::out | std::ofstream::trunc};
+        if (!output.is_open()) {
+            throw std::invalid_argument("Could not find file" + path);
+        }
+        for (const auto &counter : counters) {
+            if (counter.label == "-") {
+                output << "call " << counter.count << ' ' << counter.function << '\n';
+            } else {
+                output << "loop " << counter.count << ' ' << counter.function << ' ' << counter.label << '\n';
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3 && argc != 4) {
+        std::cerr << "usage: hotness file.counters ram.txt [file.profile]" << std::endl;
+        return 1;
+    }
+
+    auto counters = hotness::readCounters(argv[1]);
+    auto ram = hotness::readRam(argv[2]);
+    std::vector<hotness::Counter> functions, loops;
+    for (auto &counter : counters) {
+        auto hit = ram.find(counter.address);
+        counter.count = hit == ram.end() ? 0 : hit->second;
+        (counter.label == "-" ? functions : loops).push_back(counter);
+    }
+
+    hotness::print("Function calls", functions);
+    hotness::print("Loop back-edges", loops);
+    if (argc == 4) { hotness::writeProfile(argv[3], counters); }
+    return 0;
+}
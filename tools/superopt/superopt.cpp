@@ -0,0 +1,396 @@
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Superoptimizer for the VM translator's stack templates
+
+For each idiom below, search every straight-line Hack program in order of
+length until one matches the idiom's effect on the stack, and print the
+winners as src/vm/templates.hpp. Run with `make templates`.
+
+The machine model is the Hack CPU without jumps. A program may clobber A, D
+and the free slots just above the new top of stack, but every other RAM word
+must be left alone. Candidates are first matched against a handful of test
+states, which keeps the search fast, then checked against many random ones;
+a failing state is added to the test set and the search restarts from the
+same length. Sequences equivalent on every test state are only expanded
+once, which is what makes exhaustive search to five instructions tractable.
+
+Because lengths are tried in order, a template printed at length n means no
+program of fewer than n instructions over this alphabet has the same effect.
+*/
+
+namespace superopt {
+    struct Comp {
+        const char *name;
+        int16_t (*apply)(int16_t a, int16_t d, int16_t m);
+        bool readsM;
+    };
+
+    // Spelled the way the assembler expects them.
+    const std::vector<Comp> comps {
+        {"0", [](int16_t, int16_t, int16_t) -> int16_t { return 0; }, false},
+        {"1", [](int16_t, int16_t, int16_t) -> int16_t { return 1; }, false},
+        {"-1", [](int16_t, int16_t, int16_t) -> int16_t { return -1; }, false},
+        {"D", [](int16_t, int16_t d, int16_t) -> int16_t { return d; }, false},
+        {"A", [](int16_t a, int16_t, int16_t) -> int16_t { return a; }, false},
+        {"!D", [](int16_t, int16_t d, int16_t) -> int16_t { return ~d; }, false},
+        {"!A", [](int16_t a, int16_t, int16_t) -> int16_t { return ~a; }, false},
+        {"-D", [](int16_t, int16_t d, int16_t) -> int16_t { return -d; }, false},
+        {"-A", [](int16_t a, int16_t, int16_t) -> int16_t { return -a; }, false},
+        {"D+1", [](int16_t, int16_t d, int16_t) -> int16_t { return d + 1; }, false},
+        {"A+1", [](int16_t a, int16_t, int16_t) -> int16_t { return a + 1; }, false},
+        {"D-1", [](int16_t, int16_t d, int16_t) -> int16_t { return d - 1; }, false},
+        {"A-1", [](int16_t a, int16_t, int16_t) -> int16_t { return a - 1; }, false},
+        {"D+A", [](int16_t a, int16_t d, int16_t) -> int16_t { return d + a; }, false},
+        {"D-A", [](int16_t a, int16_t d, int16_t) -> int16_t { return d - a; }, false},
+        {"A-D", [](int16_t a, int16_t d, int16_t) -> int16_t { return a - d; }, false},
+        {"D&A", [](int16_t a, int16_t d, int16_t) -> int16_t { return d & a; }, false},
+        {"D|A", [](int16_t a, int16_t d, int16_t) -> int16_t { return d | a; }, false},
+        {"M", [](int16_t, int16_t, int16_t m) -> int16_t { return m; }, true},
+        {"!M", [](int16_t, int16_t, int16_t m) -> int16_t { return ~m; }, true},
+        {"-M", [](int16_t, int16_t, int16_t m) -> int16_t { return -m; }, true},
+        {"M+1", [](int16_t, int16_t, int16_t m) -> int16_t { return m + 1; }, true},
+        {"M-1", [](int16_t, int16_t, int16_t m) -> int16_t { return m - 1; }, true},
+        {"D+M", [](int16_t, int16_t d, int16_t m) -> int16_t { return d + m; }, true},
+        {"D-M", [](int16_t, int16_t d, int16_t m) -> int16_t { return d - m; }, true},
+        {"M-D", [](int16_t, int16_t d, int16_t m) -> int16_t { return m - d; }, true},
+        {"D&M", [](int16_t, int16_t d, int16_t m) -> int16_t { return d & m; }, true},
+        {"D|M", [](int16_t, int16_t d, int16_t m) -> int16_t { return d | m; }, true},
+    };
+
+    const int destM = 1, destD = 2, destA = 4;
+    const std::vector<std::pair<std::string, int>> dests {
+        {"M", destM}, {"D", destD}, {"MD", destM | destD}, {"A", destA},
+        {"AM", destA | destM}, {"AD", destA | destD}, {"AMD", destA | destM | destD},
+    };
+
+    // Either @SP (isA) or dest=comp.
+    struct Instruction {
+        bool isA;
+        int dest;
+        int comp;
+    };
+
+    std::string toString(const Instruction &instruction) {
+        if (instruction.isA) { return "@SP"; }
+        return dests[instruction.dest].first + "=" + comps[instruction.comp].name;
+    }
+
+    const int maxWrites = 8;
+
+    struct Machine {
+        int16_t a;
+        int16_t d;
+        // Initial RAM is the stack window around SP; anything else reads as
+        // a hash of its address so programs can't rely on it.
+        uint16_t sp;
+        std::array<int16_t, 6> window;
+        std::array<std::pair<uint16_t, int16_t>, maxWrites> writes;
+        int writeCount;
+        bool overflowed;
+    };
+
+    int16_t read(const Machine &machine, uint16_t address) {
+        for (int i = machine.writeCount - 1; i >= 0; i--) {
+            if (machine.writes[i].first == address) { return machine.writes[i].second; }
+        }
+        if (address == 0) { return static_cast<int16_t>(machine.sp); }
+        if (address >= machine.sp - 3 && address <= machine.sp + 2) { return machine.window[address - (machine.sp - 3)]; }
+        return static_cast<int16_t>(address * 40503u + 12345u);
+    }
+
+    void write(Machine &machine, uint16_t address, int16_t value) {
+        for (int i = 0; i < machine.writeCount; i++) {
+            if (machine.writes[i].first == address) {
+                machine.writes[i].second = value;
+                return;
+            }
+        }
+        if (machine.writeCount == maxWrites) {
+            machine.overflowed = true;
+            return;
+        }
+        machine.writes[machine.writeCount++] = {address, value};
+    }
+
+    void step(Machine &machine, const Instruction &instruction) {
+        if (instruction.isA) {
+            machine.a = 0;
+            return;
+        }
+        const auto &comp = comps[instruction.comp];
+        uint16_t address = static_cast<uint16_t>(machine.a) & 0x7fff;
+        int16_t m = comp.readsM ? read(machine, address) : 0;
+        int16_t out = comp.apply(machine.a, machine.d, m);
+        auto dest = dests[instruction.dest].second;
+        if (dest & destM) { write(machine, address, out); }
+        if (dest & destD) { machine.d = out; }
+        if (dest & destA) { machine.a = out; }
+    }
+
+    // The idiom's effect on the top three stack values; the vector is
+    // resized to the new stack depth.
+    struct Idiom {
+        std::string name;
+        std::string vmCode;
+        std::function<void(std::vector<int16_t> &)> effect;
+    };
+
+    // An initial state along with the stack the idiom should leave.
+    struct Test {
+        Machine initial;
+        uint16_t base;
+        uint16_t newSp;
+        std::vector<int16_t> stack;
+    };
+
+    Test makeTest(const Idiom &idiom, const Machine &initial) {
+        std::vector<int16_t> stack {initial.window[0], initial.window[1], initial.window[2]};
+        idiom.effect(stack);
+        uint16_t base = initial.sp - 3;
+        return {initial, base, static_cast<uint16_t>(base + stack.size()), stack};
+    }
+
+    bool matches(const Test &test, const Machine &final) {
+        if (final.overflowed) { return false; }
+        if (read(final, 0) != static_cast<int16_t>(test.newSp)) { return false; }
+        for (size_t i = 0; i < test.stack.size(); i++) {
+            if (read(final, test.base + i) != test.stack[i]) { return false; }
+        }
+        for (int i = 0; i < final.writeCount; i++) {
+            auto address = final.writes[i].first;
+            bool isStack = address >= test.base && address < test.newSp;
+            bool isFree = address >= test.newSp && address <= test.newSp + 2;
+            if (address != 0 && !isStack && !isFree) { return false; }
+        }
+        return true;
+    }
+
+    Machine randomMachine(std::mt19937 &rng) {
+        // Mostly small values, with the 16-bit edges mixed in.
+        std::uniform_int_distribution<int> pick(0, 9);
+        std::uniform_int_distribution<int> any(-32768, 32767);
+        auto value = [&]() -> int16_t {
+            switch(pick(rng)) {
+                case 0: return 0;
+                case 1: return -1;
+                case 2: return 32767;
+                case 3: return -32768;
+                case 4: return 1;
+                default: return static_cast<int16_t>(any(rng));
+            }
+        };
+
+        Machine machine {};
+        machine.sp = std::uniform_int_distribution<int>(259, 2000)(rng);
+        machine.a = value();
+        machine.d = value();
+        for (auto &cell : machine.window) { cell = value(); }
+        return machine;
+    }
+
+    uint64_t hashStates(const std::vector<Machine> &machines) {
+        uint64_t hash = 1469598103934665603ull;
+        auto mix = [&hash](uint64_t value) {
+            hash ^= value;
+            hash *= 1099511628211ull;
+        };
+        for (const auto &machine : machines) {
+            mix(static_cast<uint16_t>(machine.a));
+            mix(static_cast<uint16_t>(machine.d));
+            // Writes are order-independent once made.
+            uint64_t writes = 0;
+            for (int i = 0; i < machine.writeCount; i++) {
+                writes += (static_cast<uint64_t>(machine.writes[i].first) << 16 | static_cast<uint16_t>(machine.writes[i].second))
+                          * 0x9e3779b97f4a7c15ull;
+            }
+            mix(writes);
+            mix(machine.overflowed);
+        }
+        return hash;
+    }
+
+    class Search {
+    public:
+        Search(const std::vector<Test> &tests) : tests(tests) {
+            alphabet.push_back({true, 0, 0});
+            for (int comp = 0; comp < static_cast<int>(comps.size()); comp++) {
+                for (int dest = 0; dest < static_cast<int>(dests.size()); dest++) {
+                    alphabet.push_back({false, dest, comp});
+                }
+            }
+        }
+
+        std::optional<std::vector<Instruction>> run(int length) {
+            seen.clear();
+            program.clear();
+            std::vector<Machine> states;
+            for (const auto &test : tests) { states.push_back(test.initial); }
+            if (dfs(states, length)) { return program; }
+            return std::nullopt;
+        }
+
+    private:
+        bool dfs(const std::vector<Machine> &states, int remaining) {
+            bool done = true;
+            for (size_t i = 0; i < tests.size() && done; i++) {
+                done = matches(tests[i], states[i]);
+            }
+            if (done) { return true; }
+            if (remaining == 0) { return false; }
+
+            // A state already reached with at least as many instructions
+            // left has had every continuation of every length tried.
+            auto key = hashStates(states);
+            if (auto hit = seen.find(key); hit != seen.end() && hit->second >= remaining) { return false; }
+            seen[key] = remaining;
+
+            if (remaining == 1) { return lastInstruction(states); }
+
+            std::vector<Machine> next(states.size());
+            for (const auto &instruction : alphabet) {
+                for (size_t i = 0; i < states.size(); i++) {
+                    next[i] = states[i];
+                    step(next[i], instruction);
+                }
+                program.push_back(instruction);
+                if (dfs(next, remaining - 1)) { return true; }
+                program.pop_back();
+            }
+            return false;
+        }
+
+        // Most of the search happens here, so give up on each candidate at
+        // the first test it fails rather than running all of them.
+        bool lastInstruction(const std::vector<Machine> &states) {
+            for (const auto &instruction : alphabet) {
+                bool done = true;
+                for (size_t i = 0; i < states.size() && done; i++) {
+                    auto final = states[i];
+                    step(final, instruction);
+                    done = matches(tests[i], final);
+                }
+                if (done) {
+                    program.push_back(instruction);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const std::vector<Test> &tests;
+        std::vector<Instruction> alphabet;
+        std::vector<Instruction> program;
+        std::unordered_map<uint64_t, int> seen;
+    };
+
+    struct Result {
+        std::vector<Instruction> program;
+        unsigned int verified;
+    };
+
+    std::optional<Result> superoptimize(const Idiom &idiom, int maxLength, std::mt19937 &rng) {
+        const unsigned int verifyCount = 100000;
+        std::vector<Test> tests;
+        for (int i = 0; i < 4; i++) { tests.push_back(makeTest(idiom, randomMachine(rng))); }
+
+        for (int length = 1; length <= maxLength;) {
+            auto program = Search(tests).run(length);
+            if (!program.has_value()) {
+                length++;
+                continue;
+            }
+
+            std::optional<Test> counterexample;
+            for (unsigned int i = 0; i < verifyCount && !counterexample.has_value(); i++) {
+                auto test = makeTest(idiom, randomMachine(rng));
+                auto final = test.initial;
+                for (const auto &instruction : program.value()) { step(final, instruction); }
+                if (!matches(test, final)) { counterexample = test; }
+            }
+
+            if (!counterexample.has_value()) { return Result {program.value(), verifyCount}; }
+            tests.push_back(counterexample.value());
+        }
+        return std::nullopt;
+    }
+
+    std::vector<Idiom> idioms() {
+        auto binary = [](int16_t (*op)(int16_t, int16_t)) {
+            return [op](std::vector<int16_t> &stack) {
+                auto y = stack.back();
+                stack.pop_back();
+                stack.back() = op(stack.back(), y);
+            };
+        };
+        auto unary = [](int16_t (*op)(int16_t)) {
+            return [op](std::vector<int16_t> &stack) { stack.back() = op(stack.back()); };
+        };
+        auto push = [](int16_t value) {
+            return [value](std::vector<int16_t> &stack) { stack.push_back(value); };
+        };
+
+        return {
+            {"add", "add", binary([](int16_t x, int16_t y) -> int16_t { return x + y; })},
+            {"sub", "sub", binary([](int16_t x, int16_t y) -> int16_t { return x - y; })},
+            {"bitAnd", "and", binary([](int16_t x, int16_t y) -> int16_t { return x & y; })},
+            {"bitOr", "or", binary([](int16_t x, int16_t y) -> int16_t { return x | y; })},
+            {"neg", "neg", unary([](int16_t x) -> int16_t { return -x; })},
+            {"bitNot", "not", unary([](int16_t x) -> int16_t { return ~x; })},
+            {"pushZero", "push constant 0", push(0)},
+            {"pushOne", "push constant 1", push(1)},
+            {"pushTrue", "push constant 0; not", push(-1)},
+            {"increment", "push constant 1; add", unary([](int16_t x) -> int16_t { return x + 1; })},
+            {"decrement", "push constant 1; sub", unary([](int16_t x) -> int16_t { return x - 1; })},
+        };
+    }
+}
+
+int main() {
+    const int maxLength = 5;
+    std::mt19937 rng(2016);
+
+    std::cout << "// Generated by tools/superopt/superopt.cpp (make templates). Do not edit." << std::endl
+              << "//" << std::endl
+              << "// Each template is the shortest straight-line Hack program with the" << std::endl
+              << "// same effect on the stack as its VM code, found by exhaustive search." << std::endl
+              << "// Templates may clobber A, D and the free slots just above the stack." << std::endl
+              << std::endl
+              << "#pragma once" << std::endl
+              << std::endl
+              << "#include <string>" << std::endl
+              << "#include <vector>" << std::endl
+              << std::endl
+              << "namespace vmTemplates {" << std::endl;
+
+    bool first = true;
+    for (const auto &idiom : superopt::idioms()) {
+        auto result = superopt::superoptimize(idiom, maxLength, rng);
+        if (!result.has_value()) {
+            std::cerr << idiom.vmCode << ": nothing found up to " << maxLength << " instructions" << std::endl;
+            continue;
+        }
+
+        if (!first) { std::cout << std::endl; }
+        first = false;
+        std::cout << "    // " << idiom.vmCode << ": " << result->program.size() << " instructions, checked on "
+                  << result->verified << " random states" << std::endl
+                  << "    inline const std::vector<std::string> " << idiom.name << " {";
+        for (size_t i = 0; i < result->program.size(); i++) {
+            std::cout << (i == 0 ? "" : ", ") << "\"" << superopt::toString(result->program[i]) << "\"";
+        }
+        std::cout << "};" << std::endl;
+        std::cerr << idiom.vmCode << ": " << result->program.size() << " instructions" << std::endl;
+    }
+
+    std::cout << "}" << std::endl;
+    return 0;
+}